@@ -32,19 +32,30 @@
 #ifndef __linux__
 #include <sys/cdefs.h>
 #endif
+#include <sys/param.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include <assert.h>
+#include <ctype.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sysexits.h>
 #include <unistd.h>
 
@@ -56,6 +67,7 @@
 #include <elf.h>
 #include <elfutils/libdw.h>
 #include <elfutils/libdwfl.h>
+#include <gelf.h>
 #include <libelf.h>
 
 /* Bizarrely, elfutils doesn't make error values publically visible. */
@@ -63,18 +75,356 @@ enum {
 	DWARF_E_NO_REGFILE = 3,
 };
 
-static const char *argv0, *structname, *binary;
+/*
+ * A struct layout as recovered from DWARF.  It does not reference the Dwarf
+ * handle it came from, so it can outlive the binary (fleet mode).
+ */
+struct member {
+	char		*name;
+	char		*type_name;
+	Dwarf_Word	 offset;
+	Dwarf_Word	 size;
+	unsigned	 align;
+	unsigned	 flags;
+	Dwarf_Word	 nelems;	/* Arrays: element count */
+	Dwarf_Word	 elemsize;	/* Arrays: element size */
+	int		 encoding;	/* DW_ATE_* of the (element) scalar */
+	struct layout	*sub;		/* Struct members, for -E only */
+	unsigned	 bitoff;	/* Bitfields: first bit in the unit */
+	unsigned	 bitsize;	/* Bitfields: width */
+};
+
+#define	MEM_CONST	0x1		/* const-qualified */
+#define	MEM_ARRAY	0x2		/* Array type */
+#define	MEM_FLEX	0x4		/* Array without a constant bound */
+#define	MEM_AGGR	0x8		/* Array of structs or unions */
+#define	MEM_POINTER	0x10		/* Pointer (or array of pointers) */
+#define	MEM_STRUCT	0x20		/* Struct or union by value */
+#define	MEM_UNION	0x40		/* ... a union */
+#define	MEM_ATOMIC	0x80		/* _Atomic-qualified (or its elements) */
+#define	MEM_BITFIELD	0x100		/* Bitfield; 'offset' is its unit's */
+
+struct typeinfo {
+	char		 name[128];
+	Dwarf_Word	 size;
+	unsigned	 align;
+	unsigned	 flags;		/* MEM_* */
+	int		 encoding;	/* DW_ATE_* of the (element) scalar */
+	Dwarf_Word	 nelems;
+	Dwarf_Word	 elemsize;
+};
+
+/*
+ * Rust enums are structs holding a DW_TAG_variant_part: a discriminant and
+ * one payload struct per variant.  The discriminant is either a separate tag
+ * or a niche, stored in otherwise invalid values of a field of the one
+ * dataful variant (which then has no discriminant value of its own).
+ */
+struct enumvariant {
+	char		*name;
+	bool		 hasdiscr;
+	Dwarf_Word	 discr;
+	struct layout	*payload;
+};
+
+struct layout {
+	char		*name;
+	Dwarf_Word	 size;
+	unsigned	 align;
+	bool		 bigendian;
+	struct member	*members;
+	unsigned	 nmembers;
+	struct member	*discr;		/* Rust enums */
+	struct enumvariant *evars;
+	unsigned	 nevars;
+	bool		 nofields;	/* GCC class dump: bases only */
+	uint64_t	 hash;
+};
+
+/*
+ * A distinct layout (by hash) and the places it was found in.
+ */
+struct variant {
+	struct layout	*layout;
+	const char	**where;
+	unsigned	 nwhere, wherecap;
+};
+
+/*
+ * A global variable, collected when a report needs them.
+ */
+struct global {
+	char		*name;
+	char		*type_name;
+	Dwarf_Addr	 addr;
+	bool		 hasaddr;
+	Dwarf_Word	 size;
+	unsigned	 align;
+	unsigned	 flags;		/* MEM_* of its type */
+	unsigned	 comp;		/* GV_* */
+	Dwarf_Word	 nelems;
+	Dwarf_Word	 elemsize;
+	struct layout	*layout;	/* Of the struct (element) type */
+};
+
+/* Member composition of a global's struct type (or array element type). */
+#define	GV_FNPTRS	0x1		/* Only function pointers */
+#define	GV_ALLCONST	0x2		/* Only const members */
+
+/* ELF symbols of data objects, for globals without debug info. */
+struct symbol {
+	char		*name;
+	Dwarf_Addr	 addr;
+	Dwarf_Word	 size;
+};
+
+/* Allocated ELF sections of the binary, for reports on global data. */
+struct section {
+	char		*name;
+	Dwarf_Addr	 addr;
+	Dwarf_Word	 size;
+	bool		 write;
+	bool		 nobits;
+};
+
+/*
+ * Annotation file entries: "struct.member attr ...", "*.member attr ..." or,
+ * for global variables, "name attr ...".
+ */
+struct annot {
+	char		*scope;		/* Struct name, "*", or NULL (global) */
+	char		*name;
+	unsigned	 flags;
+	char		*role;		/* Owning writer, e.g. "producer" */
+};
+
+#define	ANNOT_RO	0x1		/* Read-mostly */
+#define	ANNOT_RW	0x2		/* Written */
+#define	ANNOT_PERCPU	0x4		/* Array indexed by CPU or thread */
+#define	ANNOT_HOT	0x8		/* Accessed on the fast path */
+#define	ANNOT_ATOMIC	0x10		/* Target of locked instructions */
+
+/*
+ * Reports run on every struct layout ('fn') and/or once per binary over its
+ * global variables ('binfn').
+ */
+struct strlist {
+	char		**v;
+	size_t		 n, cap;
+};
+
+struct report {
+	const char	*name;
+	void		(*fn)(const struct layout *);
+	void		(*binfn)(void);
+	bool		 gvlayouts;	/* binfn needs the globals' layouts */
+	bool		 enabled;
+};
+
+/* A cache level, for the "sets" report. */
+struct cachegeom {
+	size_t		 size;
+	unsigned	 ways;
+	unsigned	 line;
+};
+
+extern char **environ;
+
+static const char *argv0, *structname;
 static size_t cachelinesize = 64;
 static size_t pointer_size = sizeof(void *);
+static bool bigendian;
+static unsigned max_scalar_align = 16;
+static bool allstructs, cuvariants, dumps, fleet, quiet, timing, wantvars;
+static bool findall;		/* -a, -C or a name list: don't stop early */
+static bool wantgvlayouts;	/* Probe the struct types of globals */
+static double parwait;		/* Seconds spent waiting on workers */
+static const char *exportfmt;
+static bool btfout;		/* -E btf */
+static const char *btffile;	/* -E btf=<file> */
+static bool export_failed;
+static unsigned nthreads = 1;
+static bool lookup_done;
+static const char *header;
+static struct strlist incdirs;
+static struct strlist structnames;	/* "a,b,c" names several structs */
+static size_t nearmiss = 8;		/* -n: bytes over a threshold */
+static struct strlist inserts;		/* -i: "[name=]type" or "size[/align]" */
+static struct cachegeom geoms[4] = {	/* -G: cache levels */
+	{ 32 * 1024, 8, 64 },
+	{ 1024 * 1024, 16, 64 },
+};
+static unsigned ngeoms = 2;
+static bool geomset;
+static Dwarf_Word payloads[8] = { 64, 512, 1500 };	/* -P */
+static unsigned npayloads = 3;
+static size_t bigbuffer = 128;		/* -B: "buffers" threshold */
+static const char *orderfile;		/* -O: "order" output */
+static struct strlist cunames, cuprods;	/* -u, -p globs */
+static uint64_t culangs;		/* -l: language families, bitmask */
+
+static struct global *globals;
+static size_t nglobals, nglobalcap;
+static struct section *sections;
+static size_t nsections, nsectioncap;
+static struct symbol *symbols;
+static size_t nsymbols, nsymbolcap;
+static Dwarf_Addr *relocs;		/* Dynamic relocation targets */
+static size_t nrelocs, nreloccap;
+static size_t pagesize = 4096;
+
+static struct annot *annots;
+static size_t nannots, nannotcap;
+
+static struct variant *variants;
+static size_t nvariants, nvariantcap;
+static size_t *varhash;		/* Open addressing; variant index + 1. */
+static char **cudescs;		/* -C: 'where' strings of the CUs */
+static size_t ncudescs, ncudesccap;
+static const char *lastwhere;	/* Of the last variant_add() */
+static size_t varhashsz;
 
 static void
 usage(void)
 {
 
-	printf("Usage: %s <structname> <binary>\n", argv0);
+	printf("Usage: %s [-CFLqt] [-A annotations] [-E schema|c|btf[=file]]\n"
+	    "           [-j threads] [-B bytes] [-G cache] [-i member]\n"
+	    "           [-l lang[,...]] [-n bytes] [-O file] [-P len[,...]]\n"
+	    "           [-p producer] [-r report[,...]] [-u path]\n"
+	    "           <structname[,...]> <binary> [binary ...]\n"
+	    "       %s -a [-CFLqt] [-A annotations] [-E schema|c|btf[=file]]\n"
+	    "           [-j threads] [-B bytes] [-G cache] [-i member]\n"
+	    "           [-l lang[,...]] [-n bytes] [-O file] [-P len[,...]]\n"
+	    "           [-p producer] [-r report[,...]] [-u path]\n"
+	    "           <binary> [binary ...]\n"
+	    "       %s [-aqt] [-A annotations] [-E schema|c|btf[=file]]\n"
+	    "           [-r report[,...]] -H header [-I dir ...] [structname]\n",
+	    argv0, argv0, argv0);
 	exit(EX_USAGE);
 }
 
+static void *
+xcalloc(size_t n, size_t sz)
+{
+	void *p;
+
+	p = calloc(n, sz);
+	if (p == NULL)
+		err(EX_OSERR, "calloc");
+	return (p);
+}
+
+static void *
+xreallocarray(void *p, size_t n, size_t sz)
+{
+
+	if (sz != 0 && n > SIZE_MAX / sz)
+		errx(EX_OSERR, "reallocarray: overflow");
+	p = realloc(p, n * sz);
+	if (p == NULL)
+		err(EX_OSERR, "realloc");
+	return (p);
+}
+
+static char *
+xstrdup(const char *s)
+{
+	char *p;
+
+	p = strdup(s);
+	if (p == NULL)
+		err(EX_OSERR, "strdup");
+	return (p);
+}
+
+/* 'ns::name', or just 'name' outside of any namespace. */
+static char *
+qualname(const char *ns, const char *name)
+{
+	char *p;
+	size_t len;
+
+	if (ns == NULL)
+		return (xstrdup(name));
+	len = strlen(ns) + 2 + strlen(name) + 1;
+	if ((p = malloc(len)) == NULL)
+		err(EX_OSERR, "malloc");
+	snprintf(p, len, "%s::%s", ns, name);
+	return (p);
+}
+
+static void
+strlist_add(struct strlist *sl, char *s)
+{
+
+	if (sl->n == sl->cap) {
+		sl->cap = sl->cap ? sl->cap * 2 : 8;
+		sl->v = xreallocarray(sl->v, sl->cap, sizeof(*sl->v));
+	}
+	sl->v[sl->n++] = s;
+}
+
+static unsigned long
+getnum(const char *arg, const char *what, unsigned long min, unsigned long max)
+{
+	unsigned long val;
+	char *end;
+
+	errno = 0;
+	val = strtoul(arg, &end, 0);
+	if (errno != 0 || *arg == '\0' || *end != '\0' || val < min ||
+	    val > max)
+		errx(EX_USAGE, "invalid %s: %s", what, arg);
+	return (val);
+}
+
+/*
+ * -G size[,ways[,line]], e.g. "48k,12" or "2m,16,64".  The first -G
+ * replaces the default levels.
+ */
+static void
+cachegeom_add(char *arg)
+{
+	struct cachegeom *cg;
+	char *tok, *end;
+	unsigned long long v;
+	unsigned i;
+
+	if (!geomset)
+		ngeoms = 0;
+	geomset = true;
+	if (ngeoms == nitems(geoms))
+		errx(EX_USAGE, "at most %zu cache levels", nitems(geoms));
+	cg = &geoms[ngeoms];
+	cg->ways = 8;
+	cg->line = cachelinesize;
+	for (i = 0; (tok = strsep(&arg, ",")) != NULL; i++) {
+		errno = 0;
+		v = strtoull(tok, &end, 0);
+		if (i == 0 && (*end == 'k' || *end == 'K')) {
+			v *= 1024;
+			end++;
+		} else if (i == 0 && (*end == 'm' || *end == 'M')) {
+			v *= 1024 * 1024;
+			end++;
+		}
+		if (errno != 0 || *tok == '\0' || *end != '\0' || v == 0 ||
+		    i > 2)
+			errx(EX_USAGE, "invalid cache geometry: %s", tok);
+		if (i == 0)
+			cg->size = v;
+		else if (i == 1)
+			cg->ways = v;
+		else
+			cg->line = v;
+	}
+	if (!powerof2(cg->line) ||
+	    cg->size % ((size_t)cg->ways * cg->line) != 0)
+		errx(EX_USAGE, "cache size is not a multiple of ways x line");
+	ngeoms++;
+}
+
 static void __dead2 __printflike(6, 7)
 _dwarf_err(const char *fn, unsigned ln, const char *func, int ex, int error,
     const char *fmt, ...)
@@ -138,9 +488,24 @@ get_member_offset(Dwarf_Die *memdie, Dwarf_Word *off_out)
 	Dwarf_Word data;
 
 	if (dwarf_attr_integrate(memdie, DW_AT_data_member_location, &loc_attr)
-	    == NULL)
+	    == NULL) {
+		/* DWARF 5 bitfields: the byte holding the first bit. */
+		if (dwarf_attr_integrate(memdie, DW_AT_data_bit_offset,
+		    &loc_attr) != NULL) {
+			if (dwarf_formudata(&loc_attr, &data))
+				dwarf_err(EX_DATAERR, "dwarf_formudata(%s)",
+				    dwarf_diename(memdie));
+			*off_out = data / 8;
+			return (0);
+		}
+		/* Union members, and others at offset 0, may omit it. */
+		if (dwarf_tag(memdie) == DW_TAG_member) {
+			*off_out = 0;
+			return (0);
+		}
 		dwarf_err(EX_DATAERR, "dwarf_attr_integrate(%s/loc)",
 		    dwarf_diename(memdie));
+	}
 
 	switch (dwarf_whatform(&loc_attr)) {
 	case DW_FORM_block:
@@ -160,6 +525,7 @@ get_member_offset(Dwarf_Die *memdie, Dwarf_Word *off_out)
 	case DW_FORM_data8:
 	case DW_FORM_sdata:
 	case DW_FORM_udata:
+	case DW_FORM_implicit_const:
 		if (dwarf_formudata(&loc_attr, &data))
 		    dwarf_err(EX_DATAERR, "dwarf_formudata(%s)",
 			dwarf_diename(memdie));
@@ -174,11 +540,22 @@ get_member_offset(Dwarf_Die *memdie, Dwarf_Word *off_out)
 static int
 get_member_size(Dwarf_Die *type_die, Dwarf_Word *msize_out)
 {
+	Dwarf_Die peeled;
+
 	if (dwarf_aggregate_size(type_die, msize_out) != -1)
 		return (0);
 
-	if (dwarf_tag(type_die) == DW_TAG_pointer_type)
-		return (pointer_size);
+	if (dwarf_tag(type_die) == DW_TAG_pointer_type) {
+		*msize_out = pointer_size;
+		return (0);
+	}
+
+	/* Flexible array members have no bound, and take no space. */
+	if (dwarf_peel_type(type_die, &peeled) == 0 &&
+	    dwarf_tag(&peeled) == DW_TAG_array_type) {
+		*msize_out = 0;
+		return (0);
+	}
 
 	dwarf_err(EX_DATAERR, "dwarf_aggregate_size");
 	return (-1);
@@ -198,245 +575,7194 @@ get_dwarf_attr(Dwarf_Die *parent, int attr, Dwarf_Attribute *attr_out,
 		    dwarf_diename(parent));
 }
 
-static void
-structprobe(Dwarf *dw, Dwarf_Die *structdie)
+static inline bool
+isqualifier(int dwtag)
 {
-	Dwarf_Die memdie;
-	Dwarf_Word lastoff = 0, structsize;
-	unsigned cline, members, nholes;
-	size_t memsz, holesz;
-	int x;
-
-	(void)dw;
 
-	cline = members = nholes = 0;
-	memsz = holesz = 0;
+	if (dwtag == DW_TAG_const_type || dwtag == DW_TAG_volatile_type ||
+	    dwtag == DW_TAG_restrict_type || dwtag == DW_TAG_atomic_type)
+		return (true);
+	return (false);
+}
 
-	printf("struct %s {\n", dwarf_diename(structdie));
+/*
+ * Alignment of a type.  DW_AT_alignment is only emitted for explicitly
+ * over-aligned types, so everything else is derived: scalars are aligned to
+ * their size (up to the ABI maximum), aggregates to their strictest member.
+ */
+static unsigned
+get_type_align(Dwarf_Die *type_die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die die, child;
+	Dwarf_Word w;
+	unsigned align, a;
+	bool packed;
+	int x;
 
-	if (dwarf_aggregate_size(structdie, &structsize) == -1)
-		dwarf_err(EX_DATAERR, "dwarf_aggregate_size");
+	if (dwarf_attr_integrate(type_die, DW_AT_alignment, &attr) != NULL &&
+	    dwarf_formudata(&attr, &w) == 0 && w > 0)
+		return (w);
 
-	if (dwarf_child(structdie, &memdie)) {
-		printf("XXX ???\n");
-		exit(EX_DATAERR);
+	switch (dwarf_tag(type_die)) {
+	case DW_TAG_typedef:
+	case DW_TAG_const_type:
+	case DW_TAG_volatile_type:
+	case DW_TAG_restrict_type:
+	case DW_TAG_atomic_type:
+	case DW_TAG_array_type:
+		/* void, e.g. 'const void' */
+		if (!dwarf_hasattr(type_die, DW_AT_type))
+			return (1);
+		get_dwarf_attr(type_die, DW_AT_type, &attr, &die);
+		align = get_type_align(&die);
+		/* _Atomic scalars are naturally aligned, even 'long long'. */
+		if (dwarf_tag(type_die) == DW_TAG_atomic_type &&
+		    dwarf_aggregate_size(&die, &w) == 0 && w <= 16 &&
+		    (w & (w - 1)) == 0 && w > align)
+			align = w;
+		return (align);
+	case DW_TAG_pointer_type:
+	case DW_TAG_reference_type:
+	case DW_TAG_rvalue_reference_type:
+	case DW_TAG_ptr_to_member_type:
+		return (pointer_size);
+	case DW_TAG_structure_type:
+	case DW_TAG_class_type:
+	case DW_TAG_interface_type:
+	case DW_TAG_union_type:
+		align = 1;
+		packed = false;
+		if (dwarf_child(type_die, &child) != 0)
+			return (align);
+		do {
+			if (dwarf_tag(&child) != DW_TAG_member ||
+			    !dwarf_hasattr(&child, DW_AT_type))
+				continue;
+			get_dwarf_attr(&child, DW_AT_type, &attr, &die);
+			a = get_type_align(&die);
+			if (a > align)
+				align = a;
+			/* A misaligned member means a packed struct. */
+			if (dwarf_attr(&child, DW_AT_data_member_location,
+			    &attr) != NULL && dwarf_formudata(&attr, &w) == 0 &&
+			    w % a != 0)
+				packed = true;
+		} while ((x = dwarf_siblingof(&child, &child)) == 0);
+		if (x == -1)
+			dwarf_err(EX_DATAERR, "dwarf_siblingof");
+		if (packed || (dwarf_aggregate_size(type_die, &w) == 0 &&
+		    w % align != 0))
+			return (1);
+		return (align);
+	default:
+		if (dwarf_aggregate_size(type_die, &w) != 0 || w == 0)
+			return (1);
+		/* Largest power of two dividing the size, e.g. 16 for x87. */
+		align = w & -w;
+		if (align > max_scalar_align)
+			align = max_scalar_align;
+		return (align);
 	}
+}
+
+/*
+ * Total element count of an array type (the product of its subranges), or
+ * false if some dimension has no constant bound (flexible array members,
+ * VLAs).  'dims' receives the C declarator suffix, e.g. "[4][8]".
+ */
+static bool
+get_array_count(Dwarf_Die *array_die, Dwarf_Word *countp, char *dims,
+    size_t dimslen)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die sub;
+	Dwarf_Word count, n, lower, upper;
+	size_t len;
+	bool known;
+	int x;
 
+	count = 1;
+	known = true;
+	dims[0] = '\0';
+	if (dwarf_child(array_die, &sub) != 0)
+		return (false);
 	do {
-		Dwarf_Attribute type_attr, base_type_attr;
-		Dwarf_Die type_die, base_type_die;
-		char type_name[128], mem_name[128], ptr_suffix[32] = { '\0' };
-		const char *type_tag = "";
-		const char *type = NULL;
-		unsigned type_ptrlevel = 0;
+		if (dwarf_tag(&sub) != DW_TAG_subrange_type)
+			continue;
 
-		Dwarf_Word msize, off;
+		lower = 0;
+		if (dwarf_attr_integrate(&sub, DW_AT_lower_bound, &attr) !=
+		    NULL && dwarf_formudata(&attr, &lower) != 0)
+			lower = 0;
+		if (dwarf_attr_integrate(&sub, DW_AT_count, &attr) != NULL &&
+		    dwarf_formudata(&attr, &n) == 0)
+			;
+		else if (dwarf_attr_integrate(&sub, DW_AT_upper_bound, &attr) !=
+		    NULL && dwarf_formudata(&attr, &upper) == 0)
+			/* GCC encodes 'x[0]' as upper bound -1. */
+			n = upper + 1 - lower;
+		else {
+			known = false;
+			n = 0;
+		}
 
-		if (dwarf_tag(&memdie) != DW_TAG_member)
-			continue;
+		len = strlen(dims);
+		if (known || n != 0)
+			snprintf(dims + len, dimslen - len, "[%ju]",
+			    (uintmax_t)n);
+		else
+			snprintf(dims + len, dimslen - len, "[]");
+		count *= n;
+	} while ((x = dwarf_siblingof(&sub, &sub)) == 0);
+	if (x == -1)
+		dwarf_err(EX_DATAERR, "dwarf_siblingof");
 
-		members++;
-		/*
-		 * TODO: Handle bitfield members. DW_AT_bit_offset,
-		 * DW_AT_bit_size;
-		 */
+	*countp = count;
+	return (known);
+}
 
-	 	/* Chase down the type die of this member */
-		get_dwarf_attr(&memdie, DW_AT_type, &type_attr, &type_die);
+static unsigned format_type_name(Dwarf_Die *, char *, size_t);
 
-		/* Member offset ... */
-		if (get_member_offset(&memdie, &off) == -1)
-			dwarf_err(EX_DATAERR, "%s", dwarf_diename(&memdie));
+/*
+ * 'int (*)(void *, ...)': 'ptrlevel' pointers to function type 'fn'.  A name
+ * that does not fit is cut short.
+ */
+static void
+format_fnptr(Dwarf_Die *fn, unsigned ptrlevel, const char *qual,
+    char *type_name, size_t len)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die die, type;
+	char name[128];
+	const char *sep;
+	size_t n;
+	int x;
+	bool proto;
 
-		/* Member size. */
-		if (get_member_size(&type_die, &msize) == -1)
-			dwarf_err(EX_DATAERR, "get_member_size");
+	if (dwarf_hasattr(fn, DW_AT_type)) {
+		get_dwarf_attr(fn, DW_AT_type, &attr, &type);
+		(void)format_type_name(&type, name, sizeof(name));
+	} else
+		snprintf(name, sizeof(name), "void");
+	n = strlen(name);
+	x = snprintf(type_name, len, "%s%s(", name,
+	    n > 0 && name[n - 1] == '*' ? "" : " ");
+	if (x < 0 || (size_t)x >= len)
+		return;
+	n = x;
+	for (; ptrlevel > 0 && n + 1 < len; ptrlevel--)
+		type_name[n++] = '*';
+	type_name[n] = '\0';
+	x = snprintf(type_name + n, len - n, "%s)(", qual);
+	if (x < 0 || (size_t)x >= len - n)
+		return;
+	n += x;
 
-		/* Format name; 'struct foo', 'enum bar', 'char **', etc. */
-		if (isstruct(dwarf_tag(&type_die))) {
-			type_tag = "struct ";
-			type = dwarf_diename(&type_die);
-		} else if (dwarf_tag(&type_die) == DW_TAG_enumeration_type) {
-			type_tag = "enum ";
-			type = dwarf_diename(&type_die);
-		} else if (dwarf_tag(&type_die) == DW_TAG_pointer_type) {
-			unsigned i;
+	/* K&R 'int (*)()' also has DW_TAG_unspecified_parameters. */
+	proto = dwarf_hasattr(fn, DW_AT_prototyped);
+	sep = "";
+	if (dwarf_child(fn, &die) == 0) {
+		do {
+			if (dwarf_tag(&die) == DW_TAG_formal_parameter) {
+				get_dwarf_attr(&die, DW_AT_type, &attr, &type);
+				(void)format_type_name(&type, name,
+				    sizeof(name));
+			} else if (proto && dwarf_tag(&die) ==
+			    DW_TAG_unspecified_parameters)
+				snprintf(name, sizeof(name), "...");
+			else
+				continue;
+			x = snprintf(type_name + n, len - n, "%s%s", sep, name);
+			if (x < 0 || (size_t)x >= len - n)
+				return;
+			n += x;
+			sep = ", ";
+		} while (dwarf_siblingof(&die, &die) == 0);
+	}
+	snprintf(type_name + n, len - n, "%s)",
+	    sep[0] == '\0' && proto ? "void" : "");
+}
 
-			do {
-				if (dwarf_tag(&type_die) == DW_TAG_pointer_type)
-					type_ptrlevel++;
-				else if (isstruct(dwarf_tag(&type_die)))
-					type_tag = "struct ";
-				else if (dwarf_tag(&type_die) == DW_TAG_enumeration_type)
-					type_tag = "enum ";
-				else
-					printf("!!! XXX ignored pointer qualifier TAG %#x\n",
-					    dwarf_tag(&type_die));
-
-				/*
-				 * Pointers to basic types still need some
-				 * work. Clang doesn't emit an AT_TYPE for
-				 * 'void*,' for example.
-				 */
-				if (!dwarf_hasattr(&type_die, DW_AT_type))
-					break;
+/*
+ * Format a type name; 'struct foo', 'enum bar', 'char **', 'char[16]',
+ * 'int (*)(int)', etc.  Returns MEM_* flags for the qualifiers of the type
+ * itself.
+ */
+static unsigned
+format_type_name(Dwarf_Die *type_die_in, char *type_name, size_t len)
+{
+	Dwarf_Attribute base_type_attr;
+	Dwarf_Die type_die, base_type_die;
+	char qual[32], ptr_suffix[32] = { '\0' }, dims[64];
+	const char *type_tag = "";
+	const char *type = NULL;
+	unsigned type_ptrlevel = 0, flags = 0;
+	Dwarf_Word count;
+	bool isvolatile, isatomic, ptrqual;
 
+	type_die = *type_die_in;
+
+	/* Qualifiers of the type itself; 'const int', not 'const int *'. */
+	isvolatile = isatomic = false;
+	while (isqualifier(dwarf_tag(&type_die)) &&
+	    dwarf_hasattr(&type_die, DW_AT_type)) {
+		if (dwarf_tag(&type_die) == DW_TAG_const_type)
+			flags |= MEM_CONST;
+		else if (dwarf_tag(&type_die) == DW_TAG_volatile_type)
+			isvolatile = true;
+		else if (dwarf_tag(&type_die) == DW_TAG_atomic_type) {
+			flags |= MEM_ATOMIC;
+			isatomic = true;
+		}
+		get_dwarf_attr(&type_die, DW_AT_type, &base_type_attr,
+		    &base_type_die);
+		type_die = base_type_die;
+	}
+	snprintf(qual, sizeof(qual), "%s%s%s",
+	    (flags & MEM_CONST) != 0 ? "const " : "",
+	    isvolatile ? "volatile " : "", isatomic ? "_Atomic " : "");
+	ptrqual = dwarf_tag(&type_die) == DW_TAG_pointer_type;
+
+	if (dwarf_tag(&type_die) == DW_TAG_array_type &&
+	    dwarf_hasattr(&type_die, DW_AT_type)) {
+		/* Element qualifiers are reported as the array's. */
+		(void)get_array_count(&type_die, &count, dims, sizeof(dims));
+		get_dwarf_attr(&type_die, DW_AT_type, &base_type_attr,
+		    &base_type_die);
+		flags |= format_type_name(&base_type_die, type_name, len);
+		if (strlen(type_name) + strlen(dims) < len)
+			strcat(type_name, dims);
+		return (flags);
+	}
+
+	if (isstruct(dwarf_tag(&type_die))) {
+		type_tag = "struct ";
+		type = dwarf_diename(&type_die);
+	} else if (dwarf_tag(&type_die) == DW_TAG_union_type) {
+		type_tag = "union ";
+		type = dwarf_diename(&type_die);
+	} else if (dwarf_tag(&type_die) == DW_TAG_enumeration_type) {
+		type_tag = "enum ";
+		type = dwarf_diename(&type_die);
+	} else if (dwarf_tag(&type_die) == DW_TAG_pointer_type) {
+		unsigned i;
+
+		do {
+			if (dwarf_tag(&type_die) == DW_TAG_pointer_type)
+				type_ptrlevel++;
+			else if (isstruct(dwarf_tag(&type_die)))
+				type_tag = "struct ";
+			else if (dwarf_tag(&type_die) == DW_TAG_union_type)
+				type_tag = "union ";
+			else if (dwarf_tag(&type_die) == DW_TAG_enumeration_type)
+				type_tag = "enum ";
+			else if (dwarf_tag(&type_die) ==
+			    DW_TAG_subroutine_type) {
+				/* 'char *const', as for other pointers. */
+				if (ptrqual && qual[0] != '\0')
+					qual[strlen(qual) - 1] = '\0';
+				format_fnptr(&type_die, type_ptrlevel,
+				    ptrqual ? qual : "", type_name, len);
+				return (flags);
+			} else if (dwarf_tag(&type_die) == DW_TAG_array_type &&
+			    dwarf_hasattr(&type_die, DW_AT_type)) {
+				/* 'int (*)[4]' */
+				if (ptrqual && qual[0] != '\0')
+					qual[strlen(qual) - 1] = '\0';
+				(void)get_array_count(&type_die, &count, dims,
+				    sizeof(dims));
 				get_dwarf_attr(&type_die, DW_AT_type,
 				    &base_type_attr, &base_type_die);
-				type_die = base_type_die;
-				type_attr = base_type_attr;
-			} while (dwarf_tag(&type_die) != DW_TAG_base_type);
-
-			type = dwarf_diename(&type_die);
-			if (type_ptrlevel > sizeof(ptr_suffix) - 2)
-				type_ptrlevel = sizeof(ptr_suffix) - 2;
-			ptr_suffix[0] = ' ';
-			for (i = 1; i <= type_ptrlevel; i++)
-				ptr_suffix[i] = '*';
-			ptr_suffix[i] = '\0';
-		} else
-			type = dwarf_diename(&type_die);
-
-		if (type == NULL)
-			type = "<anonymous>";
-
-		snprintf(type_name, sizeof(type_name), "%s%s%s", type_tag,
-		    type, ptr_suffix);
-
-		if (off != lastoff) {
-			printf("\n\t/* XXX %ld bytes hole, try to pack */\n\n", off - lastoff);
-			nholes++;
-			holesz += (off - lastoff);
-		}
+				(void)format_type_name(&base_type_die, type_name,
+				    len);
+				if (type_ptrlevel > sizeof(ptr_suffix) - 1)
+					type_ptrlevel = sizeof(ptr_suffix) - 1;
+				for (i = 0; i < type_ptrlevel; i++)
+					ptr_suffix[i] = '*';
+				ptr_suffix[i] = '\0';
+				i = strlen(type_name);
+				snprintf(type_name + i, len - i, " (%s%s)%s",
+				    ptr_suffix, ptrqual ? qual : "", dims);
+				return (flags);
+			} else if (isqualifier(dwarf_tag(&type_die)) ||
+			    dwarf_tag(&type_die) == DW_TAG_typedef)
+				;
+			else
+				warnx("XXX ignored pointer qualifier TAG %#x",
+				    dwarf_tag(&type_die));
 
-		snprintf(mem_name, sizeof(mem_name), "%s;",
-		    dwarf_diename(&memdie));
+			/*
+			 * Pointers to basic types still need some
+			 * work. Clang doesn't emit an AT_TYPE for
+			 * 'void*,' for example.
+			 */
+			if (!dwarf_hasattr(&type_die, DW_AT_type))
+				break;
 
-		printf("\t%-27s%-21s /* %5ld %5ld */\n", type_name, mem_name,
-		    (long)off, (long)msize);
-		memsz += msize;
+			get_dwarf_attr(&type_die, DW_AT_type,
+			    &base_type_attr, &base_type_die);
+			type_die = base_type_die;
+		} while (dwarf_tag(&type_die) != DW_TAG_base_type);
 
-		lastoff = off + msize;
-		if (lastoff / cachelinesize > cline) {
-			int ago = lastoff % cachelinesize;
-			cline = lastoff / cachelinesize;
+		type = dwarf_diename(&type_die);
+		/* Clang and GCC both leave 'void' out. */
+		if (type == NULL && !dwarf_hasattr(&type_die, DW_AT_type) &&
+		    (dwarf_tag(&type_die) == DW_TAG_pointer_type ||
+		    isqualifier(dwarf_tag(&type_die))))
+			type = "void";
+		if (type_ptrlevel > sizeof(ptr_suffix) - 2)
+			type_ptrlevel = sizeof(ptr_suffix) - 2;
+		ptr_suffix[0] = ' ';
+		for (i = 1; i <= type_ptrlevel; i++)
+			ptr_suffix[i] = '*';
+		ptr_suffix[i] = '\0';
+	} else
+		type = dwarf_diename(&type_die);
 
-			if (ago)
-				printf("\t/* --- cacheline %u boundary (%ld "
-				    "bytes) was %d bytes ago --- */\n", cline,
-				    (long)cline * cachelinesize, ago);
-			else
-				printf("\t/* --- cacheline %u boundary (%ld "
-				    "bytes) --- */\n", cline, (long)cline *
-				    cachelinesize);
-		}
-	} while ((x = dwarf_siblingof(&memdie, &memdie)) == 0);
-	if (x == -1)
-		dwarf_err(EX_DATAERR, "dwarf_siblingof");
+	if (type == NULL)
+		type = "<anonymous>";
 
-	printf("\n\t/* size: %lu, cachelines: %u, members: %u */\n",
-	    structsize, cline + 1, members);
-	printf("\t/* sum members: %zu, holes: %u, sum holes: %zu */\n", memsz,
-	    nholes, holesz);
-	printf("\t/* last cacheline: %lu bytes */\n", lastoff % cachelinesize);
+	/* 'char *const', as 'const char *' means something else. */
+	if (ptrqual && qual[0] != '\0') {
+		qual[strlen(qual) - 1] = '\0';
+		snprintf(type_name, len, "%s%s%s%s", type_tag, type,
+		    ptr_suffix, qual);
+	} else
+		snprintf(type_name, len, "%s%s%s%s", qual, type_tag, type,
+		    ptr_suffix);
+	return (flags);
+}
 
-	printf("};\n");
+/*
+ * MEM_POINTER or MEM_STRUCT (and MEM_UNION) for a peeled type; scalars
+ * report their DW_ATE_* encoding, enums that of the underlying type.
+ */
+static unsigned
+classify_type(Dwarf_Die *peeled, int *encodingp)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die under;
+	Dwarf_Word enc;
+
+	*encodingp = 0;
+	switch (dwarf_tag(peeled)) {
+	case DW_TAG_pointer_type:
+	case DW_TAG_reference_type:
+	case DW_TAG_rvalue_reference_type:
+	case DW_TAG_ptr_to_member_type:
+		return (MEM_POINTER);
+	case DW_TAG_structure_type:
+	case DW_TAG_class_type:
+	case DW_TAG_interface_type:
+		return (MEM_STRUCT);
+	case DW_TAG_union_type:
+		return (MEM_STRUCT | MEM_UNION);
+	case DW_TAG_enumeration_type:
+		if (dwarf_attr_integrate(peeled, DW_AT_type, &attr) != NULL &&
+		    dwarf_formref_die(&attr, &under) != NULL &&
+		    dwarf_peel_type(&under, &under) == 0)
+			return (classify_type(&under, encodingp));
+		*encodingp = DW_ATE_unsigned;
+		return (0);
+	case DW_TAG_base_type:
+		if (dwarf_attr_integrate(peeled, DW_AT_encoding, &attr) !=
+		    NULL && dwarf_formudata(&attr, &enc) == 0)
+			*encodingp = enc;
+		return (0);
+	default:
+		return (0);
+	}
 }
 
+/*
+ * Size, alignment, name and shape of a member's or variable's type.
+ */
 static void
-get_elf_pointer_size(Dwarf *dw)
+get_type_info(Dwarf_Die *type_die, struct typeinfo *ti)
 {
-	Elf *elf;
-	char *elf_ident;
-	size_t elf_nident;
+	Dwarf_Attribute attr;
+	Dwarf_Die peeled, elem;
+	char dims[64];
 
-	elf = dwarf_getelf(dw);
+	memset(ti, 0, sizeof(*ti));
 
-	elf_ident = elf_getident(elf, &elf_nident);
-	assert(elf_ident != NULL && elf_nident > EI_CLASS);
+	if (get_member_size(type_die, &ti->size) == -1)
+		dwarf_err(EX_DATAERR, "get_member_size");
+	ti->align = get_type_align(type_die);
+	ti->flags = format_type_name(type_die, ti->name, sizeof(ti->name));
 
-	switch ((uint8_t)elf_ident[EI_CLASS]) {
-	case ELFCLASS32:
-		pointer_size = 4;
-		break;
-	case ELFCLASS64:
-		pointer_size = 8;
-		break;
-	case ELFCLASSNONE:
-	default:
-		errx(EX_DATAERR, "Bogus ELF ident header, machine class=%u.\n",
-		    (unsigned)elf_ident[EI_CLASS]);
+	/* Look through typedefs and qualifiers. */
+	if (dwarf_peel_type(type_die, &peeled) != 0)
+		return;
+	if (dwarf_tag(&peeled) != DW_TAG_array_type ||
+	    !dwarf_hasattr(&peeled, DW_AT_type)) {
+		ti->flags |= classify_type(&peeled, &ti->encoding);
+		return;
 	}
+
+	ti->flags |= MEM_ARRAY;
+	if (!get_array_count(&peeled, &ti->nelems, dims, sizeof(dims)))
+		ti->flags |= MEM_FLEX;
+
+	get_dwarf_attr(&peeled, DW_AT_type, &attr, &elem);
+	if (dwarf_aggregate_size(&elem, &ti->elemsize) != 0)
+		ti->elemsize = 0;
+	if (dwarf_peel_type(&elem, &elem) != 0)
+		return;
+	if ((classify_type(&elem, &ti->encoding) & MEM_STRUCT) != 0)
+		ti->flags |= MEM_AGGR;
+	else
+		ti->flags |= classify_type(&elem, &ti->encoding);
 }
 
-int
-main(int argc, char **argv)
+static uint64_t
+fnv1a(uint64_t h, const void *buf, size_t len)
 {
-	Dwarf_Off off, lastoff;
-	Dwarf *dw;
+	const unsigned char *p = buf;
 
-	size_t hdr_size;
-	int cufd, error;
-
-	argv0 = argv[0];
-	if (argc < 3)
-		usage();
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ull;
+	}
+	return (h);
+}
 
-	structname = argv[1];
-	binary = argv[2];
+/*
+ * Canonical layout hash: depends only on the names, types, offsets and sizes
+ * of the struct and its members, never on DIE offsets, so the same layout
+ * hashes identically in every CU and every binary.
+ */
+static uint64_t
+layout_hash(const struct layout *lay)
+{
+	const struct member *mem;
+	uint64_t h, w;
+	unsigned i;
 
-	elf_version(EV_CURRENT);
+	h = 0xcbf29ce484222325ull;
+	h = fnv1a(h, lay->name, strlen(lay->name) + 1);
+	w = lay->size;
+	h = fnv1a(h, &w, sizeof(w));
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		h = fnv1a(h, mem->name, strlen(mem->name) + 1);
+		h = fnv1a(h, mem->type_name, strlen(mem->type_name) + 1);
+		w = mem->offset;
+		h = fnv1a(h, &w, sizeof(w));
+		w = mem->size;
+		h = fnv1a(h, &w, sizeof(w));
+		if ((mem->flags & MEM_BITFIELD) != 0) {
+			w = (Dwarf_Word)mem->bitoff << 32 | mem->bitsize;
+			h = fnv1a(h, &w, sizeof(w));
+		}
+	}
+	if (lay->discr != NULL) {
+		w = lay->discr->offset;
+		h = fnv1a(h, &w, sizeof(w));
+		w = lay->discr->size;
+		h = fnv1a(h, &w, sizeof(w));
+	}
+	for (i = 0; i < lay->nevars; i++) {
+		h = fnv1a(h, lay->evars[i].name,
+		    strlen(lay->evars[i].name) + 1);
+		w = lay->evars[i].hasdiscr ? lay->evars[i].discr : ~0ull;
+		h = fnv1a(h, &w, sizeof(w));
+		w = lay->evars[i].payload->hash;
+		h = fnv1a(h, &w, sizeof(w));
+	}
+	return (h);
+}
 
-	cufd = open(binary, O_RDONLY);
-	if (cufd == -1)
-		err(EX_USAGE, "open");
+static void
+layout_free(struct layout *lay)
+{
+	unsigned i;
 
-	dw = dwarf_begin(cufd, DWARF_C_READ);
-	if (dw == NULL) {
-		error = dwarf_errno();
-		if (error == DWARF_E_NO_REGFILE)
-			errx(EX_USAGE, "%s: Not a regular file", binary);
-		dwarf_err_errno(EX_DATAERR, error, "dwarf_begin");
+	for (i = 0; i < lay->nmembers; i++) {
+		free(lay->members[i].name);
+		free(lay->members[i].type_name);
+		if (lay->members[i].sub != NULL)
+			layout_free(lay->members[i].sub);
+	}
+	free(lay->members);
+	if (lay->discr != NULL) {
+		free(lay->discr->name);
+		free(lay->discr->type_name);
+		free(lay->discr);
+	}
+	for (i = 0; i < lay->nevars; i++) {
+		free(lay->evars[i].name);
+		layout_free(lay->evars[i].payload);
 	}
+	free(lay->evars);
+	free(lay->name);
+	free(lay);
+}
 
-	get_elf_pointer_size(dw);
+static struct layout *structprobe(Dwarf *, Dwarf_Die *, const char *);
+static Dwarf_Word dump_type_size(const char *, struct member *);
 
-	/* XXX worry about .debug_types sections later. */
+/*
+ * Fill in 'mem' from a DW_TAG_member DIE; 'type_die' receives its type.
+ */
+static struct member *
+probe_member(Dwarf_Die *memdie, struct member *mem, Dwarf_Die *type_die)
+{
+	Dwarf_Attribute type_attr, attr;
+	struct typeinfo ti;
+	Dwarf_Word off, bit;
+	int bitsize, bo, unit;
 
-	lastoff = off = 0;
-	while (dwarf_nextcu(dw, off, &off, &hdr_size, NULL, NULL, NULL) == 0) {
-		Dwarf_Die cu_die, die;
-		int x;
+ 	/* Chase down the type die of this member */
+	get_dwarf_attr(memdie, DW_AT_type, &type_attr, type_die);
 
-		if (dwarf_offdie(dw, lastoff + hdr_size, &cu_die) == NULL)
-			continue;
-		lastoff = off;
+	/* Member offset ... */
+	if (get_member_offset(memdie, &off) == -1)
+		dwarf_err(EX_DATAERR, "%s", dwarf_diename(memdie));
 
-		/*
-		 * A CU may be empty because e.g. an empty (or fully #if0'd)
-		 * file is compiled.
-		 */
-		if (dwarf_child(&cu_die, &die))
-			continue;
+	/* ... size, alignment and name of its type. */
+	get_type_info(type_die, &ti);
 
-		/* Loop through all DIEs in the CU. */
-		do {
-			if (isstruct(dwarf_tag(&die)) &&
-			    dwarf_haschildren(&die) &&
-			    dwarf_diename(&die) &&
-			    strcmp(dwarf_diename(&die), structname) == 0) {
-				structprobe(dw, &die);
-				goto out;
-			}
+	memset(mem, 0, sizeof(*mem));
+	mem->name = xstrdup(dwarf_diename(memdie) != NULL ?
+	    dwarf_diename(memdie) : "<anonymous>");
+	mem->type_name = xstrdup(ti.name);
+	mem->offset = off;
+	mem->size = ti.size;
+	mem->align = ti.align;
+	mem->flags = ti.flags;
+	mem->nelems = ti.nelems;
+	mem->elemsize = ti.elemsize;
+	mem->encoding = ti.encoding;
 
-		} while ((x = dwarf_siblingof(&die, &die)) == 0);
-		if (x == -1)
-			dwarf_err(EX_DATAERR, "dwarf_siblingof");
+	/*
+	 * Bitfields are placed by their storage unit, as DWARF 4 does; DWARF 5
+	 * gives only the first bit, and DWARF 2/3 count bits from the MSB.
+	 */
+	if ((bitsize = dwarf_bitsize(memdie)) <= 0)
+		return (mem);
+	mem->flags |= MEM_BITFIELD;
+	mem->bitsize = bitsize;
+	if (dwarf_attr_integrate(memdie, DW_AT_data_bit_offset, &attr) !=
+	    NULL && dwarf_formudata(&attr, &bit) == 0) {
+		if (ti.size > 0) {
+			mem->offset = bit / 8 / ti.size * ti.size;
+			if (bit + bitsize > (mem->offset + ti.size) * 8)
+				mem->offset = bit / 8;
+		}
+		mem->bitoff = bit - mem->offset * 8;
+	} else if ((bo = dwarf_bitoffset(memdie)) >= 0) {
+		unit = dwarf_bytesize(memdie) > 0 ? dwarf_bytesize(memdie) :
+		    (int)ti.size;
+		if (bigendian)
+			mem->bitoff = bo;
+		else if (unit * 8 >= bo + bitsize)
+			mem->bitoff = unit * 8 - bo - bitsize;
 	}
+	return (mem);
+}
 
-out:
-	if (dwarf_end(dw))
-		dwarf_err(EX_SOFTWARE, "dwarf_end");
+static void
+probe_variant_part(Dwarf *dw, Dwarf_Die *vpdie, struct layout *lay)
+{
+	struct enumvariant *ev;
+	Dwarf_Attribute attr;
+	Dwarf_Die die, vdie, memdie, type_die;
+	Dwarf_Word off;
+	unsigned cap, i;
+	int x;
+
+	if (dwarf_attr(vpdie, DW_AT_discr, &attr) != NULL &&
+	    dwarf_formref_die(&attr, &die) != NULL)
+		lay->discr = probe_member(&die,
+		    xcalloc(1, sizeof(*lay->discr)), &type_die);
+
+	if (dwarf_child(vpdie, &vdie) != 0)
+		return;
+	cap = lay->nevars;
+	do {
+		if (dwarf_tag(&vdie) != DW_TAG_variant ||
+		    dwarf_child(&vdie, &memdie) != 0)
+			continue;
+		while (dwarf_tag(&memdie) != DW_TAG_member)
+			if (dwarf_siblingof(&memdie, &memdie) != 0)
+				goto next;
+
+		if (lay->nevars == cap) {
+			cap = cap ? cap * 2 : 8;
+			lay->evars = xreallocarray(lay->evars, cap,
+			    sizeof(*lay->evars));
+		}
+		ev = &lay->evars[lay->nevars++];
+		memset(ev, 0, sizeof(*ev));
+		ev->name = xstrdup(dwarf_diename(&memdie) != NULL ?
+		    dwarf_diename(&memdie) : "<anonymous>");
+		if (dwarf_attr(&vdie, DW_AT_discr_value, &attr) != NULL &&
+		    dwarf_formudata(&attr, &ev->discr) == 0)
+			ev->hasdiscr = true;
+
+		get_dwarf_attr(&memdie, DW_AT_type, &attr, &type_die);
+		ev->payload = structprobe(dw, &type_die, NULL);
+		if (get_member_offset(&memdie, &off) == 0 && off != 0)
+			for (i = 0; i < ev->payload->nmembers; i++)
+				ev->payload->members[i].offset += off;
+next:
+		;
+	} while ((x = dwarf_siblingof(&vdie, &vdie)) == 0);
+	if (x == -1)
+		dwarf_err(EX_DATAERR, "dwarf_siblingof");
+}
+
+/*
+ * Stable sort of the members by offset.  rustc reorders fields but emits
+ * them in declaration order; C and C++ members are already sorted.
+ */
+static void
+sort_members(struct layout *lay)
+{
+	struct member t;
+	unsigned i, j;
+
+	for (i = 1; i < lay->nmembers; i++) {
+		t = lay->members[i];
+		for (j = i; j > 0 && lay->members[j - 1].offset > t.offset;
+		    j--)
+			lay->members[j] = lay->members[j - 1];
+		lay->members[j] = t;
+	}
+}
+
+/*
+ * Build the layout of a struct DIE.  'ns' is the enclosing namespace path
+ * (C++, Rust), if any.
+ */
+static struct layout *
+structprobe(Dwarf *dw, Dwarf_Die *structdie, const char *ns)
+{
+	struct layout *lay;
+	struct member *mem;
+	Dwarf_Die memdie;
+	const char *name;
+	unsigned memcap;
+	int x;
+
+	lay = xcalloc(1, sizeof(*lay));
+	name = dwarf_diename(structdie) != NULL ? dwarf_diename(structdie) :
+	    "<anonymous>";
+	lay->name = qualname(ns, name);
+	lay->align = get_type_align(structdie);
+	lay->bigendian = bigendian;
+
+	if (dwarf_aggregate_size(structdie, &lay->size) == -1)
+		dwarf_err(EX_DATAERR, "dwarf_aggregate_size");
+
+	/* Only nested types (e.g. unit enum variants) can be empty. */
+	if (dwarf_child(structdie, &memdie)) {
+		lay->hash = layout_hash(lay);
+		return (lay);
+	}
+
+	memcap = 0;
+	do {
+		Dwarf_Die type_die, peeled;
+
+		if (dwarf_tag(&memdie) == DW_TAG_variant_part) {
+			probe_variant_part(dw, &memdie, lay);
+			continue;
+		}
+		if (dwarf_tag(&memdie) != DW_TAG_member)
+			continue;
+
+		if (lay->nmembers == memcap) {
+			memcap = memcap ? memcap * 2 : 16;
+			lay->members = xreallocarray(lay->members, memcap,
+			    sizeof(*lay->members));
+		}
+		mem = probe_member(&memdie, &lay->members[lay->nmembers++],
+		    &type_die);
+
+		/* The schema exporter flattens nested structs. */
+		if (exportfmt != NULL && (mem->flags & MEM_STRUCT) != 0 &&
+		    (mem->flags & MEM_ARRAY) == 0 &&
+		    dwarf_peel_type(&type_die, &peeled) == 0 &&
+		    dwarf_haschildren(&peeled))
+			mem->sub = structprobe(dw, &peeled, NULL);
+	} while ((x = dwarf_siblingof(&memdie, &memdie)) == 0);
+	if (x == -1)
+		dwarf_err(EX_DATAERR, "dwarf_siblingof");
+
+	sort_members(lay);
+	lay->hash = layout_hash(lay);
+	return (lay);
+}
+
+/* End of the bytes a Rust enum variant uses, discriminant included. */
+static Dwarf_Word
+evar_extent(const struct layout *lay, const struct enumvariant *ev)
+{
+	const struct member *mem;
+	Dwarf_Word end;
+	unsigned i;
+
+	end = lay->discr != NULL ? lay->discr->offset + lay->discr->size : 0;
+	for (i = 0; i < ev->payload->nmembers; i++) {
+		mem = &ev->payload->members[i];
+		if (mem->offset + mem->size > end)
+			end = mem->offset + mem->size;
+	}
+	return (end);
+}
+
+/*
+ * A discriminant stored inside a variant's field (a niche, e.g. the null
+ * pointer of Option<&T>) rather than in a tag of its own.
+ */
+static const struct member *
+enum_niche(const struct layout *lay, const struct enumvariant **evp)
+{
+	const struct member *mem, *d = lay->discr;
+	unsigned i, j;
+
+	if (d == NULL)
+		return (NULL);
+	for (i = 0; i < lay->nevars; i++)
+		for (j = 0; j < lay->evars[i].payload->nmembers; j++) {
+			mem = &lay->evars[i].payload->members[j];
+			if (d->offset < mem->offset + mem->size &&
+			    mem->offset < d->offset + d->size) {
+				*evp = &lay->evars[i];
+				return (mem);
+			}
+		}
+	return (NULL);
+}
+
+/*
+ * Rust enums: where the discriminant lives, what each variant uses of the
+ * enum's size, and what boxing the largest variant would buy.
+ */
+static void
+enum_print(const struct layout *lay)
+{
+	const struct enumvariant *ev, *big, *next, *nev;
+	const struct member *mem, *niche;
+	Dwarf_Word ext, bigext, nextext, est, floor;
+	unsigned i, j;
+	char mem_name[128];
+
+	printf("enum %s {\n", lay->name);
+
+	niche = enum_niche(lay, &nev);
+	if (lay->discr == NULL)
+		printf("\t/* no discriminant */\n");
+	else if (niche != NULL)
+		printf("\t/* discriminant: niche in %s.%s, offset %lu, size "
+		    "%lu */\n", nev->name, niche->name,
+		    (unsigned long)lay->discr->offset,
+		    (unsigned long)lay->discr->size);
+	else
+		printf("\t/* discriminant: tag %s, offset %lu, size %lu */\n",
+		    lay->discr->type_name, (unsigned long)lay->discr->offset,
+		    (unsigned long)lay->discr->size);
+
+	big = next = NULL;
+	bigext = nextext = 0;
+	for (i = 0; i < lay->nevars; i++) {
+		ev = &lay->evars[i];
+		ext = evar_extent(lay, ev);
+		if (big == NULL || ext > bigext) {
+			next = big;
+			nextext = bigext;
+			big = ev;
+			bigext = ext;
+		} else if (next == NULL || ext > nextext) {
+			next = ev;
+			nextext = ext;
+		}
+
+		printf("\n\t%s", ev->name);
+		if (ev->hasdiscr)
+			printf(" = %lu", (unsigned long)ev->discr);
+		printf(" {\t/* used: %lu of %lu */\n", (unsigned long)ext,
+		    (unsigned long)lay->size);
+		for (j = 0; j < ev->payload->nmembers; j++) {
+			mem = &ev->payload->members[j];
+			snprintf(mem_name, sizeof(mem_name), "%s;", mem->name);
+			printf("\t\t%-27s%-13s /* %5ld %5ld */\n",
+			    mem->type_name, mem_name, (long)mem->offset,
+			    (long)mem->size);
+		}
+		printf("\t}\n");
+	}
+
+	printf("\n\t/* size: %lu, cachelines: %lu, variants: %u */\n",
+	    lay->size, (unsigned long)howmany(lay->size, cachelinesize),
+	    lay->nevars);
+	if (big != NULL && next != NULL && bigext > nextext) {
+		printf("\t/* largest variant: %s (%lu bytes), next: %s (%lu "
+		    "bytes) */\n", big->name, (unsigned long)bigext,
+		    next->name, (unsigned long)nextext);
+
+		/*
+		 * Boxed, the largest variant keeps a pointer after the tag;
+		 * rustc may well do better by re-laying out the others.
+		 */
+		floor = niche == NULL && lay->discr != NULL ?
+		    roundup(lay->discr->offset + lay->discr->size,
+		    pointer_size) : 0;
+		est = MAX(nextext, floor + pointer_size);
+		est = roundup(est, lay->align ? lay->align : 1);
+		if (est < lay->size)
+			printf("\t/* %sboxing %s would shrink the enum to "
+			    "about %lu bytes (-%lu) */\n",
+			    bigext >= 2 * nextext ? "XXX bloated: " : "",
+			    big->name, (unsigned long)est,
+			    (unsigned long)(lay->size - est));
+	}
+	printf("};\n");
+}
+
+static void
+layout_print(const struct layout *lay)
+{
+	const struct member *mem;
+	Dwarf_Word lastoff = 0;
+	unsigned cline, i, nholes;
+	size_t memsz, holesz;
+	Dwarf_Word start, end;
+	char mem_name[128];
+
+	if (lay->nevars > 0) {
+		enum_print(lay);
+		return;
+	}
+
+	cline = nholes = 0;
+	memsz = holesz = 0;
+
+	printf("struct %s {\n", lay->name);
+
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+
+		/*
+		 * A bitfield's unit may overlap its neighbours; only the
+		 * bytes its bits occupy are counted.
+		 */
+		start = mem->offset;
+		end = mem->offset + mem->size;
+		if ((mem->flags & MEM_BITFIELD) != 0) {
+			start += mem->bitoff / 8;
+			end = mem->offset + howmany(mem->bitoff + mem->bitsize,
+			    8);
+		}
+		if (start > lastoff && !lay->nofields) {
+			printf("\n\t/* XXX %ld bytes hole, try to pack */\n\n",
+			    start - lastoff);
+			nholes++;
+			holesz += (start - lastoff);
+		}
+
+		if ((mem->flags & MEM_BITFIELD) != 0)
+			snprintf(mem_name, sizeof(mem_name), "%s:%u;",
+			    mem->name, mem->bitsize);
+		else
+			snprintf(mem_name, sizeof(mem_name), "%s;", mem->name);
+
+		printf("\t%-27s%-21s /* %5ld %5ld */\n", mem->type_name,
+		    mem_name, (long)mem->offset, (long)mem->size);
+		if (end <= lastoff)
+			continue;
+		memsz += end - (start > lastoff ? start : lastoff);
+
+		lastoff = end;
+		if (lastoff / cachelinesize > cline) {
+			int ago = lastoff % cachelinesize;
+			cline = lastoff / cachelinesize;
+
+			if (ago)
+				printf("\t/* --- cacheline %u boundary (%ld "
+				    "bytes) was %d bytes ago --- */\n", cline,
+				    (long)cline * cachelinesize, ago);
+			else
+				printf("\t/* --- cacheline %u boundary (%ld "
+				    "bytes) --- */\n", cline, (long)cline *
+				    cachelinesize);
+		}
+	}
+
+	if (lay->nofields) {
+		printf("\n\t/* size: %lu, cachelines: %lu, align: %u */\n",
+		    lay->size, (unsigned long)howmany(lay->size,
+		    cachelinesize), lay->align);
+		printf("\t/* data members are not in GCC class dumps */\n");
+		printf("};\n");
+		return;
+	}
+
+	printf("\n\t/* size: %lu, cachelines: %u, members: %u */\n",
+	    lay->size, cline + 1, lay->nmembers);
+	printf("\t/* sum members: %zu, holes: %u, sum holes: %zu */\n", memsz,
+	    nholes, holesz);
+	printf("\t/* last cacheline: %lu bytes */\n", lastoff % cachelinesize);
+
+	printf("};\n");
+}
+
+/*
+ * A run of members moved as one: a member on its own, or bitfields together
+ * with every member their storage units overlap.
+ */
+struct unit {
+	unsigned	 first, n;	/* Members first .. first + n - 1 */
+	Dwarf_Word	 start, end;
+	unsigned	 align;
+	bool		 bitfield;
+};
+
+/*
+ * Split the members of 'lay' into units.  Bitfields are placed by their
+ * storage unit, which can overlap the bitfields and members around it, so
+ * they cannot be moved one at a time; overlaps not involving a bitfield
+ * (unions) are left alone.  'unit', if not NULL, receives each member's
+ * unit index.
+ */
+static struct unit *
+layout_units(const struct layout *lay, unsigned *unit, unsigned *nunitsp)
+{
+	const struct member *mem;
+	struct unit *units, u, *t;
+	unsigned i, j, nunits;
+
+	units = xcalloc(MAX(lay->nmembers, 1), sizeof(*units));
+	nunits = 0;
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		u.first = i;
+		u.n = 1;
+		u.start = mem->offset;
+		u.end = mem->offset + mem->size;
+		u.align = MAX(mem->align, 1);
+		u.bitfield = (mem->flags & MEM_BITFIELD) != 0;
+		while (nunits > 0) {
+			t = &units[nunits - 1];
+			if ((!t->bitfield && !u.bitfield) ||
+			    u.start >= t->end || t->start >= u.end)
+				break;
+			u.first = t->first;
+			u.n += t->n;
+			u.start = MIN(u.start, t->start);
+			u.end = MAX(u.end, t->end);
+			u.align = MAX(u.align, t->align);
+			u.bitfield = true;
+			nunits--;
+		}
+		units[nunits++] = u;
+	}
+	if (unit != NULL)
+		for (i = 0; i < nunits; i++)
+			for (j = 0; j < units[i].n; j++)
+				unit[units[i].first + j] = i;
+	*nunitsp = nunits;
+	return (units);
+}
+
+/*
+ * Build a copy of 'lay' with the members placed in 'order' at their natural
+ * alignment.  Members with 'newline' set (indexed like 'order') start a new
+ * cacheline, which only holds with the struct aligned to one; the copy's
+ * alignment says so.  Bitfields move with their unit (layout_units()), at
+ * the position of its first member in 'order'.
+ */
+static struct layout *
+layout_repack(const struct layout *lay, const unsigned *order,
+    const bool *newline)
+{
+	struct layout *nl;
+	struct member *mem;
+	struct unit *units, *u;
+	Dwarf_Word off;
+	unsigned *unit, i, j, k, nunits;
+	bool *placed, brk;
+
+	nl = xcalloc(1, sizeof(*nl));
+	nl->name = xstrdup(lay->name);
+	nl->align = lay->align;
+	nl->nmembers = lay->nmembers;
+	nl->members = xcalloc(MAX(lay->nmembers, 1), sizeof(*nl->members));
+
+	unit = xcalloc(MAX(lay->nmembers, 1), sizeof(*unit));
+	units = layout_units(lay, unit, &nunits);
+	placed = xcalloc(MAX(nunits, 1), sizeof(*placed));
+
+	off = 0;
+	k = 0;
+	brk = false;
+	for (i = 0; i < lay->nmembers; i++) {
+		if (newline != NULL && newline[i])
+			brk = true;
+		u = &units[unit[order[i]]];
+		if (placed[unit[order[i]]])
+			continue;
+		placed[unit[order[i]]] = true;
+
+		if (brk) {
+			off = roundup(off, cachelinesize);
+			nl->align = MAX(nl->align, cachelinesize);
+			brk = false;
+		}
+		off = roundup(off, u->align);
+		for (j = u->first; j < u->first + u->n; j++) {
+			mem = &nl->members[k++];
+			*mem = lay->members[j];
+			mem->name = xstrdup(mem->name);
+			mem->type_name = xstrdup(mem->type_name);
+			mem->sub = NULL;
+			mem->offset = off + (lay->members[j].offset - u->start);
+		}
+		off += u->end - u->start;
+	}
+	nl->size = roundup(off, MAX(nl->align, 1));
+	nl->hash = layout_hash(nl);
+	free(placed);
+	free(units);
+	free(unit);
+	return (nl);
+}
+
+/*
+ * Stable sort of member indices by decreasing alignment, which packs a group
+ * of members without introducing holes.
+ */
+static void
+order_by_align(const struct layout *lay, unsigned *idx, unsigned n)
+{
+	unsigned i, j, t;
+
+	for (i = 1; i < n; i++) {
+		t = idx[i];
+		for (j = i; j > 0 && lay->members[idx[j - 1]].align <
+		    lay->members[t].align; j--)
+			idx[j] = idx[j - 1];
+		idx[j] = t;
+	}
+}
+
+static bool
+member_on_line(const struct member *mem, Dwarf_Word line)
+{
+	Dwarf_Word start = line * cachelinesize;
+
+	return (mem->size > 0 && mem->offset < start + cachelinesize &&
+	    mem->offset + mem->size > start);
+}
+
+static char *
+nexttok(char **sp)
+{
+	char *tok;
+
+	while ((tok = strsep(sp, " \t\r\n")) != NULL && *tok == '\0')
+		;
+	return (tok);
+}
+
+static void
+annot_load(const char *path)
+{
+	struct annot *an;
+	FILE *fp;
+	char *line, *p, *tok, *dot;
+	size_t linecap;
+	unsigned lineno;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(EX_NOINPUT, "%s", path);
+
+	line = NULL;
+	linecap = 0;
+	lineno = 0;
+	while (getline(&line, &linecap, fp) > 0) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		p = line;
+		if ((tok = nexttok(&p)) == NULL)
+			continue;
+
+		if (nannots == nannotcap) {
+			nannotcap = nannotcap ? nannotcap * 2 : 64;
+			annots = xreallocarray(annots, nannotcap,
+			    sizeof(*annots));
+		}
+		an = &annots[nannots++];
+		memset(an, 0, sizeof(*an));
+
+		if ((dot = strchr(tok, '.')) != NULL) {
+			*dot = '\0';
+			an->scope = xstrdup(tok);
+			tok = dot + 1;
+		}
+		an->name = xstrdup(tok);
+
+		while ((tok = nexttok(&p)) != NULL) {
+			if (strcmp(tok, "ro") == 0)
+				an->flags |= ANNOT_RO;
+			else if (strcmp(tok, "rw") == 0)
+				an->flags |= ANNOT_RW;
+			else if (strcmp(tok, "percpu") == 0)
+				an->flags |= ANNOT_PERCPU;
+			else if (strcmp(tok, "hot") == 0)
+				an->flags |= ANNOT_HOT;
+			else if (strcmp(tok, "atomic") == 0)
+				an->flags |= ANNOT_ATOMIC;
+			else if (strncmp(tok, "role=", 5) == 0 &&
+			    tok[5] != '\0') {
+				free(an->role);
+				an->role = xstrdup(tok + 5);
+				an->flags |= ANNOT_RW;
+			} else
+				errx(EX_DATAERR, "%s:%u: unknown annotation "
+				    "'%s'", path, lineno, tok);
+		}
+	}
+	if (ferror(fp))
+		err(EX_IOERR, "%s", path);
+	free(line);
+	fclose(fp);
+}
+
+/*
+ * Annotation for member 'name' of struct 'scope', or for the global 'name'
+ * if 'scope' is NULL.  An exact struct match wins over a "*" wildcard.
+ */
+static const struct annot *
+annot_find(const char *scope, const char *name)
+{
+	const struct annot *an, *wild;
+	size_t i;
+
+	wild = NULL;
+	for (i = 0; i < nannots; i++) {
+		an = &annots[i];
+		if (strcmp(an->name, name) != 0)
+			continue;
+		if (scope == NULL || an->scope == NULL) {
+			if (scope == an->scope)
+				return (an);
+			continue;
+		}
+		if (strcmp(an->scope, scope) == 0)
+			return (an);
+		if (strcmp(an->scope, "*") == 0)
+			wild = an;
+	}
+	return (wild);
+}
+
+/*
+ * Read-mostly members: annotated "ro", or const-qualified unless annotated
+ * "rw".
+ */
+static bool
+member_readmostly(const struct layout *lay, const struct member *mem)
+{
+	const struct annot *an;
+
+	an = annot_find(lay->name, mem->name);
+	if (an != NULL && (an->flags & (ANNOT_RO | ANNOT_RW)) != 0)
+		return ((an->flags & ANNOT_RO) != 0);
+	return ((mem->flags & MEM_CONST) != 0);
+}
+
+static void
+print_line_members(const struct layout *lay, Dwarf_Word line,
+    const bool *sel, bool want)
+{
+	const char *sep = "";
+	unsigned i;
+
+	for (i = 0; i < lay->nmembers; i++) {
+		if (sel[i] != want || !member_on_line(&lay->members[i], line))
+			continue;
+		printf("%s%s", sep, lay->members[i].name);
+		sep = ", ";
+	}
+}
+
+/*
+ * "rw": cachelines holding both read-mostly and written members.  Each write
+ * invalidates the line in every other core's cache, including the copies
+ * only held for the read-mostly data.  Proposes a layout with the read-mostly
+ * members first and the written ones starting on a fresh cacheline.
+ */
+static void
+report_rw(const struct layout *lay)
+{
+	struct layout *seg;
+	struct unit *units;
+	Dwarf_Word line, nlines;
+	unsigned *order, i, j, n, nro, nmixed, nr, nw, nunits;
+	bool *ro, *newline;
+
+	/* Writing a bitfield writes its whole unit. */
+	ro = xcalloc(MAX(lay->nmembers, 1), sizeof(*ro));
+	units = layout_units(lay, NULL, &nunits);
+	for (i = 0; i < nunits; i++) {
+		for (j = 0; j < units[i].n; j++)
+			if (!member_readmostly(lay,
+			    &lay->members[units[i].first + j]))
+				break;
+		for (n = 0; n < units[i].n; n++)
+			ro[units[i].first + n] = j == units[i].n;
+	}
+	free(units);
+	nro = 0;
+	for (i = 0; i < lay->nmembers; i++)
+		if (ro[i])
+			nro++;
+	if (nro == 0 || nro == lay->nmembers) {
+		free(ro);
+		return;
+	}
+
+	nmixed = 0;
+	nlines = howmany(lay->size, cachelinesize);
+	for (line = 0; line < nlines; line++) {
+		nr = nw = 0;
+		for (i = 0; i < lay->nmembers; i++) {
+			if (!member_on_line(&lay->members[i], line))
+				continue;
+			if (ro[i])
+				nr++;
+			else
+				nw++;
+		}
+		if (nr == 0 || nw == 0)
+			continue;
+
+		nmixed++;
+		printf("/* rw: cacheline %ju mixes read-mostly ",
+		    (uintmax_t)line);
+		print_line_members(lay, line, ro, true);
+		printf(" with written ");
+		print_line_members(lay, line, ro, false);
+		printf(" */\n");
+	}
+	if (nmixed == 0) {
+		printf("/* rw: no cacheline mixes read-mostly and written "
+		    "members */\n");
+		free(ro);
+		return;
+	}
+
+	order = xcalloc(lay->nmembers, sizeof(*order));
+	newline = xcalloc(lay->nmembers, sizeof(*newline));
+	n = 0;
+	for (i = 0; i < lay->nmembers; i++)
+		if (ro[i])
+			order[n++] = i;
+	order_by_align(lay, order, n);
+	newline[n] = true;
+	for (i = 0; i < lay->nmembers; i++)
+		if (!ro[i])
+			order[n++] = i;
+	order_by_align(lay, &order[nro], n - nro);
+
+	seg = layout_repack(lay, order, newline);
+	printf("/* rw: proposed segregated layout, alignas(%u), %+jd bytes, "
+	    "cachelines: %ju -> %ju */\n", seg->align,
+	    (intmax_t)seg->size - (intmax_t)lay->size,
+	    (uintmax_t)nlines, (uintmax_t)howmany(seg->size, cachelinesize));
+	layout_print(seg);
+
+	layout_free(seg);
+	free(newline);
+	free(order);
+	free(ro);
+}
+
+static const char *
+member_role(const struct layout *lay, const struct member *mem)
+{
+	const struct annot *an;
+
+	an = annot_find(lay->name, mem->name);
+	return (an != NULL ? an->role : NULL);
+}
+
+/*
+ * "owner": partition members by writer role ("role=" annotations).  Every
+ * role gets its own cachelines so that writers never invalidate each other's
+ * lines.  To keep the line count down, members without a role fill the tail
+ * of role lines where they fit: written ones first, then read-mostly ones,
+ * which then share a line with one writer rather than several.  The rest
+ * get lines of their own at the end.  Growth over the current line count
+ * is flagged, as it is only paid back when the roles write concurrently.
+ */
+static void
+report_owner(const struct layout *lay)
+{
+	struct layout *part;
+	const char **roles, *role, *sep;
+	Dwarf_Word line, nlines, pos, *gend;
+	unsigned *owned, *gstart, *rest, *fill, *order;
+	unsigned i, j, k, r, n, nroles, nowned, nrest, nshared, nr;
+	bool *newline, *onl, first;
+
+	n = lay->nmembers;
+	roles = xcalloc(MAX(n, 1), sizeof(*roles));
+	nroles = 0;
+	for (i = 0; i < n; i++) {
+		if ((role = member_role(lay, &lay->members[i])) == NULL)
+			continue;
+		for (j = 0; j < nroles; j++)
+			if (strcmp(roles[j], role) == 0)
+				break;
+		if (j == nroles)
+			roles[nroles++] = role;
+	}
+	if (nroles < 2) {
+		free(roles);
+		return;
+	}
+
+	/* Lines written by more than one role in the current layout. */
+	onl = xcalloc(n, sizeof(*onl));
+	nshared = 0;
+	nlines = howmany(lay->size, cachelinesize);
+	for (line = 0; line < nlines; line++) {
+		nr = 0;
+		for (j = 0; j < nroles; j++) {
+			for (i = 0; i < n; i++) {
+				role = member_role(lay, &lay->members[i]);
+				if (role != NULL && strcmp(role, roles[j]) == 0 &&
+				    member_on_line(&lay->members[i], line))
+					break;
+			}
+			if (i < n)
+				nr++;
+		}
+		if (nr < 2)
+			continue;
+
+		nshared++;
+		printf("/* owner: cacheline %ju is written by", (uintmax_t)line);
+		sep = " ";
+		for (j = 0; j < nroles; j++) {
+			for (i = 0; i < n; i++) {
+				role = member_role(lay, &lay->members[i]);
+				onl[i] = role != NULL &&
+				    strcmp(role, roles[j]) == 0;
+			}
+			for (i = 0; i < n; i++)
+				if (onl[i] && member_on_line(&lay->members[i],
+				    line))
+					break;
+			if (i == n)
+				continue;
+			printf("%s%s (", sep, roles[j]);
+			print_line_members(lay, line, onl, true);
+			printf(")");
+			sep = ", ";
+		}
+		printf(" */\n");
+	}
+	free(onl);
+	if (nshared == 0) {
+		printf("/* owner: no cacheline is written by more than one "
+		    "role */\n");
+		free(roles);
+		return;
+	}
+
+	/*
+	 * Lay out each role's members from a fresh line, most aligned first,
+	 * tracking where each role's last line ends.
+	 */
+	owned = xcalloc(n, sizeof(*owned));
+	gstart = xcalloc(nroles + 1, sizeof(*gstart));
+	gend = xcalloc(nroles, sizeof(*gend));
+	nowned = 0;
+	for (j = 0; j < nroles; j++) {
+		gstart[j] = nowned;
+		for (i = 0; i < n; i++) {
+			role = member_role(lay, &lay->members[i]);
+			if (role != NULL && strcmp(role, roles[j]) == 0)
+				owned[nowned++] = i;
+		}
+		order_by_align(lay, &owned[gstart[j]], nowned - gstart[j]);
+		for (k = gstart[j]; k < nowned; k++)
+			gend[j] = roundup(gend[j],
+			    MAX(lay->members[owned[k]].align, 1)) +
+			    lay->members[owned[k]].size;
+	}
+	gstart[nroles] = nowned;
+
+	rest = xcalloc(n, sizeof(*rest));
+	nrest = 0;
+	for (i = 0; i < n; i++)
+		if (member_role(lay, &lay->members[i]) == NULL)
+			rest[nrest++] = i;
+	order_by_align(lay, rest, nrest);
+
+	/*
+	 * First fit of unowned members into the tails of role lines, written
+	 * members first; fill[r] is the role whose line rest[r] joins, nroles
+	 * for none.
+	 */
+	fill = xcalloc(MAX(nrest, 1), sizeof(*fill));
+	for (r = 0; r < nrest; r++)
+		fill[r] = nroles;
+	for (k = 0; k < nrest * 2; k++) {
+		r = k % nrest;
+		i = rest[r];
+		if (member_readmostly(lay, &lay->members[i]) != (k >= nrest))
+			continue;
+		for (j = 0; j < nroles; j++) {
+			if (gend[j] % cachelinesize == 0)
+				continue;
+			pos = roundup(gend[j], MAX(lay->members[i].align, 1));
+			if (pos + lay->members[i].size >
+			    roundup(gend[j], cachelinesize))
+				continue;
+			fill[r] = j;
+			gend[j] = pos + lay->members[i].size;
+			break;
+		}
+	}
+
+	order = xcalloc(n, sizeof(*order));
+	newline = xcalloc(n, sizeof(*newline));
+	k = 0;
+	for (j = 0; j < nroles; j++) {
+		newline[k] = k > 0;
+		for (i = gstart[j]; i < gstart[j + 1]; i++)
+			order[k++] = owned[i];
+		for (r = 0; r < nrest; r++)
+			if (fill[r] == j)
+				order[k++] = rest[r];
+	}
+	first = true;
+	for (r = 0; r < nrest; r++) {
+		if (fill[r] != nroles)
+			continue;
+		newline[k] = first;
+		first = false;
+		order[k++] = rest[r];
+	}
+
+	part = layout_repack(lay, order, newline);
+	printf("/* owner: %u of %ju cachelines shared by writer roles; "
+	    "partitioned layout, alignas(%u), costs %+jd bytes, cachelines: "
+	    "%ju -> %ju */\n", nshared, (uintmax_t)nlines, part->align,
+	    (intmax_t)part->size - (intmax_t)lay->size, (uintmax_t)nlines,
+	    (uintmax_t)howmany(part->size, cachelinesize));
+	if (howmany(part->size, cachelinesize) > nlines)
+		printf("/* owner: %s grows by %ju cacheline%s; only worth it "
+		    "if the roles write concurrently */\n", lay->name,
+		    (uintmax_t)(howmany(part->size, cachelinesize) - nlines),
+		    howmany(part->size, cachelinesize) - nlines == 1 ? "" :
+		    "s");
+	layout_print(part);
+
+	layout_free(part);
+	free(newline);
+	free(order);
+	free(fill);
+	free(rest);
+	free(gend);
+	free(gstart);
+	free(owned);
+	free(roles);
+}
+
+/*
+ * Arrays that are indexed by CPU or thread: annotated "percpu", or with a
+ * name component (between underscores or case changes, "cpu_stats",
+ * "perThread") that is a hint or its plural.  "score" or "coredump" are not.
+ */
+static bool
+ispercpu(const char *scope, const char *name)
+{
+	static const char *const hints[] = {
+		"cpu", "pcpu", "percpu", "thread", "core", "worker", "shard",
+	};
+	const struct annot *an;
+	const char *p, *q;
+	size_t i, n, hl;
+
+	an = annot_find(scope, name);
+	if (an != NULL && (an->flags & ANNOT_PERCPU) != 0)
+		return (true);
+	for (p = name; *p != '\0'; p = q) {
+		if (!isalnum((unsigned char)*p)) {
+			q = p + 1;
+			continue;
+		}
+		for (q = p + 1; isalnum((unsigned char)*q) &&
+		    !(isupper((unsigned char)*q) &&
+		    islower((unsigned char)q[-1])); q++)
+			;
+		n = q - p;
+		for (i = 0; i < nitems(hints); i++) {
+			hl = strlen(hints[i]);
+			if ((n == hl || (n == hl + 1 &&
+			    tolower((unsigned char)p[hl]) == 's')) &&
+			    strncasecmp(p, hints[i], hl) == 0)
+				return (true);
+		}
+	}
+	return (false);
+}
+
+/*
+ * Check an array of 'n' elements of 'esize' bytes that starts 'base' bytes
+ * into a cacheline for lines shared by neighbouring elements.
+ */
+static void
+array_check(const char *name, const char *type_name, Dwarf_Word n,
+    Dwarf_Word esize, Dwarf_Word base)
+{
+	Dwarf_Word k, b, line, lastline, shared, pad;
+
+	shared = 0;
+	lastline = (Dwarf_Word)-1;
+	for (k = 1; k < n; k++) {
+		b = base + k * esize;
+		if (b % cachelinesize == 0)
+			continue;
+		line = b / cachelinesize;
+		if (line != lastline) {
+			shared++;
+			lastline = line;
+		}
+	}
+	if (shared == 0)
+		return;
+
+	pad = roundup(esize, cachelinesize) - esize;
+	printf("/* arrays: %s (%s): %ju-byte elements share %ju cacheline%s "
+	    "between neighbours; ", name, type_name, (uintmax_t)esize,
+	    (uintmax_t)shared, shared == 1 ? "" : "s");
+	if (pad > 0)
+		printf("padding each element by %ju bytes costs %ju bytes",
+		    (uintmax_t)pad, (uintmax_t)(pad * n));
+	if (base != 0)
+		printf("%saligning the array to a cacheline (now +%ju)",
+		    pad > 0 ? " plus " : "", (uintmax_t)base);
+	printf(" */\n");
+}
+
+/*
+ * "arrays": per-CPU and per-thread arrays of structs whose element size is
+ * not a multiple of the cacheline, so that neighbouring CPUs' elements share
+ * lines.
+ */
+static void
+report_arrays(const struct layout *lay)
+{
+	const struct member *mem;
+	unsigned i;
+
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		if ((mem->flags & MEM_AGGR) == 0 ||
+		    (mem->flags & MEM_FLEX) != 0 || mem->nelems < 2 ||
+		    mem->elemsize == 0 || !ispercpu(lay->name, mem->name))
+			continue;
+		array_check(mem->name, mem->type_name, mem->nelems,
+		    mem->elemsize, mem->offset % cachelinesize);
+	}
+}
+
+static void
+report_arrays_globals(void)
+{
+	const struct global *gv;
+	size_t i;
+
+	for (i = 0; i < nglobals; i++) {
+		gv = &globals[i];
+		if ((gv->flags & MEM_AGGR) == 0 ||
+		    (gv->flags & MEM_FLEX) != 0 || gv->nelems < 2 ||
+		    gv->elemsize == 0 || !ispercpu(NULL, gv->name))
+			continue;
+		array_check(gv->name, gv->type_name, gv->nelems, gv->elemsize,
+		    gv->hasaddr ? gv->addr % cachelinesize : 0);
+	}
+}
+
+static const struct section *
+section_find(Dwarf_Addr addr)
+{
+	size_t i;
+
+	for (i = 0; i < nsections; i++)
+		if (addr >= sections[i].addr &&
+		    addr < sections[i].addr + sections[i].size)
+			return (&sections[i]);
+	return (NULL);
+}
+
+static const char *
+rodata_reason(const struct global *gv)
+{
+
+	if ((gv->flags & MEM_CONST) != 0)
+		return ("declared const");
+	if ((gv->comp & GV_FNPTRS) != 0)
+		return ("function pointers only");
+	if ((gv->comp & GV_ALLCONST) != 0)
+		return ("const members only");
+	return (NULL);
+}
+
+static int
+rodata_cmp(const void *a, const void *b)
+{
+	const struct global *ga = *(const struct global *const *)a;
+	const struct global *gb = *(const struct global *const *)b;
+	int rc;
+
+	if ((rc = strcmp(ga->type_name, gb->type_name)) != 0)
+		return (rc);
+	if ((rc = strcmp(section_find(ga->addr)->name,
+	    section_find(gb->addr)->name)) != 0)
+		return (rc);
+	return (strcmp(ga->name, gb->name));
+}
+
+/*
+ * Initialized writable globals that could be read-only: function pointer
+ * tables (ops structs), structs of const members and const-qualified
+ * objects that still landed in .data.  .data.rel.ro is read-only once
+ * relocated, and a table in .bss is filled in at run time; neither is
+ * reported.
+ */
+static void
+report_rodata_globals(void)
+{
+	const struct global **cand, *gv;
+	const struct section *sec;
+	struct { const char *name; Dwarf_Word bytes; size_t n; } *persec;
+	Dwarf_Word bytes, total;
+	size_t i, j, k, n, npersec;
+
+	cand = xcalloc(MAX(nglobals, 1), sizeof(*cand));
+	persec = xcalloc(MAX(nsections, 1), sizeof(*persec));
+	n = npersec = 0;
+	for (i = 0; i < nglobals; i++) {
+		gv = &globals[i];
+		if (!gv->hasaddr || gv->size == 0 ||
+		    (sec = section_find(gv->addr)) == NULL || !sec->write ||
+		    sec->nobits || strncmp(sec->name, ".data.rel.ro", 12) == 0 ||
+		    rodata_reason(gv) == NULL)
+			continue;
+		cand[n++] = gv;
+	}
+	qsort(cand, n, sizeof(*cand), rodata_cmp);
+
+	total = 0;
+	for (i = 0; i < n; i = j) {
+		sec = section_find(cand[i]->addr);
+		bytes = 0;
+		for (j = i; j < n && strcmp(cand[j]->type_name,
+		    cand[i]->type_name) == 0 &&
+		    section_find(cand[j]->addr) == sec; j++)
+			bytes += cand[j]->size;
+		printf("/* rodata: %s (%s): %zu instance%s, %ju bytes in %s:",
+		    cand[i]->type_name, rodata_reason(cand[i]), j - i,
+		    j - i == 1 ? "" : "s", (uintmax_t)bytes, sec->name);
+		for (k = i; k < j && k < i + 8; k++)
+			printf("%s %s", k > i ? "," : "", cand[k]->name);
+		printf("%s */\n", j - i > 8 ? ", ..." : "");
+
+		for (k = 0; k < npersec; k++)
+			if (persec[k].name == sec->name)
+				break;
+		if (k == npersec)
+			persec[npersec++].name = sec->name;
+		persec[k].bytes += bytes;
+		persec[k].n += j - i;
+		total += bytes;
+	}
+	for (k = 0; k < npersec; k++)
+		printf("/* rodata: %s: %ju bytes in %zu global%s could be "
+		    "const */\n", persec[k].name, (uintmax_t)persec[k].bytes,
+		    persec[k].n, persec[k].n == 1 ? "" : "s");
+	if (npersec > 1)
+		printf("/* rodata: total %ju bytes */\n", (uintmax_t)total);
+	free(persec);
+	free(cand);
+}
+
+/*
+ * Prefork page sharing.  A forked worker that writes a global dirties, and
+ * privately copies, the whole page holding it, along with whatever
+ * read-mostly data shares that page.  Globals come from DWARF and, for
+ * objects without debug info, the symbol table; written ones are those
+ * annotated "rw".
+ */
+struct pobj {
+	const char	*name;
+	Dwarf_Addr	 addr;
+	Dwarf_Word	 size;
+	unsigned	 align;
+	bool		 dwarf;
+	bool		 written;
+	const struct section *sec;
+};
+
+static int
+pobj_cmp(const void *a, const void *b)
+{
+	const struct pobj *pa = a, *pb = b;
+
+	if (pa->addr != pb->addr)
+		return (pa->addr < pb->addr ? -1 : 1);
+	return ((int)pb->dwarf - (int)pa->dwarf);
+}
+
+static bool
+pagedata(const struct section *sec)
+{
+
+	return (sec != NULL && sec->write &&
+	    (strncmp(sec->name, ".data", 5) == 0 ||
+	    strncmp(sec->name, ".bss", 4) == 0) &&
+	    strncmp(sec->name, ".data.rel.ro", 12) != 0);
+}
+
+static size_t
+pobj_load(struct pobj **objsp)
+{
+	const struct annot *an;
+	struct pobj *objs, *o;
+	const struct section *sec;
+	size_t i, n, m;
+
+	objs = xcalloc(nglobals + nsymbols + 1, sizeof(*objs));
+	n = 0;
+	for (i = 0; i < nglobals; i++) {
+		if (!globals[i].hasaddr || globals[i].size == 0 ||
+		    !pagedata(sec = section_find(globals[i].addr)))
+			continue;
+		o = &objs[n++];
+		o->name = globals[i].name;
+		o->addr = globals[i].addr;
+		o->size = globals[i].size;
+		o->align = MAX(globals[i].align, 1);
+		o->dwarf = true;
+		o->sec = sec;
+	}
+	for (i = 0; i < nsymbols; i++) {
+		if (!pagedata(sec = section_find(symbols[i].addr)))
+			continue;
+		o = &objs[n++];
+		o->name = symbols[i].name;
+		o->addr = symbols[i].addr;
+		o->size = symbols[i].size;
+		o->align = MIN(symbols[i].size & -symbols[i].size, 16);
+		o->sec = sec;
+	}
+	qsort(objs, n, sizeof(*objs), pobj_cmp);
+
+	/* One object per address, preferring the DWARF variable. */
+	for (i = m = 0; i < n; i++) {
+		if (m > 0 && objs[m - 1].addr == objs[i].addr)
+			continue;
+		objs[m] = objs[i];
+		an = annot_find(NULL, objs[m].name);
+		objs[m].written = an != NULL && (an->flags & ANNOT_RW) != 0;
+		m++;
+	}
+	*objsp = objs;
+	return (m);
+}
+
+/* Distinct units of 'unit' bytes touched by [start, start + size). */
+static void
+count_span(Dwarf_Addr start, Dwarf_Word size, size_t unit, Dwarf_Addr *last,
+    size_t *n)
+{
+	Dwarf_Addr first, end;
+
+	first = start / unit;
+	end = (start + MAX(size, 1) - 1) / unit;
+	if (*last != (Dwarf_Addr)-1 && first <= *last)
+		first = *last + 1;
+	if (end >= first)
+		*n += end - first + 1;
+	if (*last == (Dwarf_Addr)-1 || end > *last)
+		*last = end;
+}
+
+/* Pages the written objects of 'bss' or not dirty now. */
+static size_t
+pages_dirty(const struct pobj *objs, size_t n, bool bss)
+{
+	Dwarf_Addr last;
+	size_t i, np;
+
+	last = (Dwarf_Addr)-1;
+	np = 0;
+	for (i = 0; i < n; i++)
+		if (objs[i].written && objs[i].sec->nobits == bss)
+			count_span(objs[i].addr, objs[i].size, pagesize, &last,
+			    &np);
+	return (np);
+}
+
+/* Pages needed to pack the written objects of 'bss' or not together. */
+static size_t
+pages_packed(const struct pobj *objs, size_t n, bool bss, size_t *nobj)
+{
+	Dwarf_Word off;
+	unsigned align;
+	size_t i;
+
+	off = 0;
+	*nobj = 0;
+	for (align = 16; align > 0; align /= 2)
+		for (i = 0; i < n; i++) {
+			if (!objs[i].written || objs[i].sec->nobits != bss ||
+			    MIN(objs[i].align, 16) != align)
+				continue;
+			off = roundup(off, align) + objs[i].size;
+			(*nobj)++;
+		}
+	return (howmany(off, pagesize));
+}
+
+static void
+print_hot_group(const struct pobj *objs, size_t n, bool bss)
+{
+	unsigned align;
+	size_t i, k;
+
+	k = 0;
+	printf("/* pages: suggested %s group:", bss ? ".bss" : ".data");
+	for (align = 16; align > 0; align /= 2)
+		for (i = 0; i < n; i++) {
+			if (!objs[i].written || objs[i].sec->nobits != bss ||
+			    MIN(objs[i].align, 16) != align)
+				continue;
+			printf("%s %s", k++ > 0 ? "," : "", objs[i].name);
+		}
+	printf(" */\n");
+}
+
+static int
+addr_cmp(const void *a, const void *b)
+{
+	Dwarf_Addr x = *(const Dwarf_Addr *)a, y = *(const Dwarf_Addr *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static bool
+pobj_onpage(const struct pobj *o, Dwarf_Addr page)
+{
+
+	return (o->addr < (page + 1) * pagesize &&
+	    o->addr + o->size > page * pagesize);
+}
+
+static void
+report_pages_globals(void)
+{
+	struct pobj *objs;
+	const struct pobj *o;
+	Dwarf_Addr *dirty, page, first, last;
+	Dwarf_Word coldbytes;
+	size_t i, j, k, n, m, nwritten, npages, ndirty, ncold, ndata, nbss;
+	size_t ndatao, nbsso, ddata, dbss, save, cap;
+
+	n = pobj_load(&objs);
+	dirty = NULL;
+	ndirty = cap = nwritten = 0;
+	npages = 0;
+	page = (Dwarf_Addr)-1;
+	for (i = 0; i < n; i++) {
+		o = &objs[i];
+		first = o->addr / pagesize;
+		last = (o->addr + o->size - 1) / pagesize;
+		npages += last - first + (first != page);
+		page = last;
+		if (!o->written)
+			continue;
+		nwritten++;
+		for (page = first; page <= last; page++) {
+			if (ndirty == cap) {
+				cap = cap ? cap * 2 : 64;
+				dirty = xreallocarray(dirty, cap,
+				    sizeof(*dirty));
+			}
+			dirty[ndirty++] = page;
+		}
+		page = last;
+	}
+	if (nwritten == 0) {
+		printf("/* pages: %zu globals on %zu .data/.bss pages; none "
+		    "annotated rw */\n", n, npages);
+		free(objs);
+		return;
+	}
+	qsort(dirty, ndirty, sizeof(*dirty), addr_cmp);
+	for (i = m = 0; i < ndirty; i++)
+		if (m == 0 || dirty[m - 1] != dirty[i])
+			dirty[m++] = dirty[i];
+	ndirty = m;
+
+	for (i = 0; i < ndirty; i++) {
+		page = dirty[i];
+		coldbytes = ncold = 0;
+		printf("/* pages: page %#jx:", (uintmax_t)(page * pagesize));
+		for (j = k = 0; j < n; j++) {
+			o = &objs[j];
+			if (!pobj_onpage(o, page))
+				continue;
+			if (o->written) {
+				printf("%s %s", k++ > 0 ? "," : " written",
+				    o->name);
+				continue;
+			}
+			coldbytes += MIN(o->addr + o->size, (page + 1) *
+			    pagesize) - MAX(o->addr, page * pagesize);
+			ncold++;
+		}
+		printf("; %zu cold global%s, %ju bytes", ncold,
+		    ncold == 1 ? "" : "s", (uintmax_t)coldbytes);
+		for (j = k = 0; j < n && k < 4; j++)
+			if (!objs[j].written && pobj_onpage(&objs[j], page))
+				printf("%s%s", k++ > 0 ? ", " : " (",
+				    objs[j].name);
+		printf("%s */\n", k == 0 ? "" : ncold > 4 ? ", ...)" : ")");
+	}
+
+	/*
+	 * .data and .bss are grouped apart, so each group is weighed against
+	 * the pages its section's written globals dirty now; a page the two
+	 * sections share is not split for it.
+	 */
+	ndata = pages_packed(objs, n, false, &ndatao);
+	nbss = pages_packed(objs, n, true, &nbsso);
+	ddata = pages_dirty(objs, n, false);
+	dbss = pages_dirty(objs, n, true);
+	save = 0;
+	if (ndatao > 0 && ndata < ddata)
+		save += ddata - ndata;
+	if (nbsso > 0 && nbss < dbss)
+		save += dbss - nbss;
+	if (save == 0)
+		printf("/* pages: %zu written globals dirty %zu of %zu pages "
+		    "per worker; grouping them saves none */\n", nwritten,
+		    ndirty, npages);
+	else
+		printf("/* pages: %zu written globals dirty %zu of %zu pages "
+		    "per worker; grouped, %zu */\n", nwritten, ndirty, npages,
+		    ndirty > save ? ndirty - save : 1);
+	if (ndatao > 0 && ndata < ddata)
+		print_hot_group(objs, n, false);
+	if (nbsso > 0 && nbss < dbss)
+		print_hot_group(objs, n, true);
+	free(dirty);
+	free(objs);
+}
+
+/*
+ * Link-time ordering of hot globals (-O).  Objects annotated "rw" are
+ * write-hot, those annotated "hot" but not "rw" read-mostly hot.  In
+ * .data and in .bss, the write-hot objects come first, then, from a fresh
+ * cacheline so that writes never invalidate their lines, the read-mostly
+ * ones; each group by decreasing alignment and size, which packs it into
+ * the fewest lines and pages.
+ */
+#define	OBJ_WHOT	1
+#define	OBJ_RHOT	2
+
+struct oplace {
+	const struct pobj *obj;
+	const char	*sym;
+	int		 kind;
+	Dwarf_Word	 off;		/* Projected, from a page boundary */
+};
+
+static int
+hot_kind(const struct pobj *o)
+{
+	const struct annot *an;
+
+	an = annot_find(NULL, o->name);
+	if (an == NULL)
+		return (0);
+	if ((an->flags & ANNOT_RW) != 0)
+		return (OBJ_WHOT);
+	if ((an->flags & ANNOT_HOT) != 0)
+		return (OBJ_RHOT);
+	return (0);
+}
+
+static int
+oplace_cmp(const void *a, const void *b)
+{
+	const struct oplace *pa = a, *pb = b;
+
+	if (pa->obj->sec->nobits != pb->obj->sec->nobits)
+		return (pa->obj->sec->nobits ? 1 : -1);
+	if (pa->kind != pb->kind)
+		return (pa->kind - pb->kind);
+	if (MIN(pa->obj->align, 64) != MIN(pb->obj->align, 64))
+		return (MIN(pa->obj->align, 64) > MIN(pb->obj->align, 64) ?
+		    -1 : 1);
+	if (pa->obj->size != pb->obj->size)
+		return (pa->obj->size > pb->obj->size ? -1 : 1);
+	return (strcmp(pa->sym, pb->sym));
+}
+
+static void
+order_write(const char *path, const struct oplace *pl, size_t n)
+{
+	const char *sec;
+	FILE *fp;
+	size_t i, len;
+	bool script, first, last;
+
+	len = strlen(path);
+	script = (len > 3 && strcmp(path + len - 3, ".ld") == 0) ||
+	    (len > 4 && strcmp(path + len - 4, ".lds") == 0);
+	if ((fp = fopen(path, "w")) == NULL)
+		err(EX_CANTCREAT, "%s", path);
+
+	for (i = 0; i < n; i++) {
+		if (!script) {
+			/* lld --symbol-ordering-file */
+			fprintf(fp, "%s\n", pl[i].sym);
+			continue;
+		}
+
+		/* GNU ld script fragment for -fdata-sections objects. */
+		sec = pl[i].obj->sec->nobits ? "bss" : "data";
+		first = i == 0 || pl[i - 1].obj->sec->nobits !=
+		    pl[i].obj->sec->nobits;
+		last = i + 1 == n || pl[i + 1].obj->sec->nobits !=
+		    pl[i].obj->sec->nobits;
+		if (first)
+			fprintf(fp, "%sSECTIONS\n{\n\t.%s.hot%s : ALIGN(%zu)\n"
+			    "\t{\n", i > 0 ? "\n" : "", sec,
+			    pl[i].obj->sec->nobits ? " (NOLOAD)" : "",
+			    pagesize);
+		if (first || pl[i - 1].kind != pl[i].kind)
+			fprintf(fp, "%s\t\t/* %s */\n", first ? "" :
+			    "\t\t. = ALIGN(64);\n", pl[i].kind == OBJ_WHOT ?
+			    "write-hot" : "read-mostly hot");
+		/* -fPIC puts initialized pointers in .data.rel[.local]. */
+		if (pl[i].obj->sec->nobits)
+			fprintf(fp, "\t\t*(.bss.%s)\n", pl[i].sym);
+		else
+			fprintf(fp, "\t\t*(.data.%s .data.rel.%s "
+			    ".data.rel.local.%s)\n", pl[i].sym, pl[i].sym,
+			    pl[i].sym);
+		if (last)
+			fprintf(fp, "\t\t. = ALIGN(64);\n\t}\n}\nINSERT "
+			    "BEFORE .%s;\n", sec);
+	}
+	if (ferror(fp) || fclose(fp) != 0)
+		err(EX_IOERR, "%s", path);
+}
+
+/*
+ * "order": the cachelines and pages the hot globals take now and once
+ * ordered, and the lines where write-hot globals share a line with other
+ * data.  -O writes the order as an lld symbol ordering file or, for paths
+ * ending in ".ld" or ".lds", a GNU ld script fragment.  Only the script
+ * can pad between the groups and after them; with an ordering file the
+ * boundary lines may still be shared.
+ */
+static void
+report_order_globals(void)
+{
+	struct pobj *objs;
+	struct oplace *pl;
+	const struct pobj *o;
+	Dwarf_Addr lastline, lastpage, line;
+	Dwarf_Word off;
+	size_t i, j, k, n, npl, nw, nd, lo, hi, nlines[2], npages[2];
+	size_t nshared[2], plines, ppages;
+	bool keep;
+	int b;
+
+	n = pobj_load(&objs);
+	pl = xcalloc(MAX(n, 1), sizeof(*pl));
+	npl = nw = 0;
+	for (i = 0; i < n; i++) {
+		if (hot_kind(&objs[i]) == 0)
+			continue;
+		pl[npl].obj = &objs[i];
+		pl[npl].kind = hot_kind(&objs[i]);
+		pl[npl].sym = objs[i].name;
+		for (j = 0; j < nsymbols; j++)
+			if (symbols[j].addr == objs[i].addr) {
+				pl[npl].sym = symbols[j].name;
+				break;
+			}
+		if (pl[npl].kind == OBJ_WHOT)
+			nw++;
+		npl++;
+	}
+	if (npl == 0) {
+		printf("/* order: no .data/.bss globals annotated hot or rw "
+		    "*/\n");
+		goto out;
+	}
+
+	/* Now: objs and so pl are in address order; [1] is .bss. */
+	memset(nlines, 0, sizeof(nlines));
+	memset(npages, 0, sizeof(npages));
+	memset(nshared, 0, sizeof(nshared));
+	lastline = lastpage = (Dwarf_Addr)-1;
+	for (i = 0; i < npl; i++) {
+		o = pl[i].obj;
+		if (i > 0 && pl[i - 1].obj->sec->nobits != o->sec->nobits)
+			lastline = lastpage = (Dwarf_Addr)-1;
+		count_span(o->addr, o->size, cachelinesize, &lastline,
+		    &nlines[o->sec->nobits]);
+		count_span(o->addr, o->size, pagesize, &lastpage,
+		    &npages[o->sec->nobits]);
+	}
+	lastline = (Dwarf_Addr)-1;
+	for (i = 0; i < npl; i++) {
+		if (pl[i].kind != OBJ_WHOT)
+			continue;
+		o = pl[i].obj;
+		for (line = MAX(o->addr / cachelinesize, lastline + 1);
+		    line <= (o->addr + o->size - 1) / cachelinesize; line++)
+			for (j = 0; j < n; j++)
+				if (hot_kind(&objs[j]) != OBJ_WHOT &&
+				    objs[j].addr < (line + 1) * cachelinesize &&
+				    objs[j].addr + objs[j].size > line *
+				    cachelinesize) {
+					nshared[o->sec->nobits]++;
+					break;
+				}
+		lastline = (o->addr + o->size - 1) / cachelinesize;
+	}
+
+	printf("/* order: %zu write-hot and %zu read-mostly hot globals */\n",
+	    nw, npl - nw);
+
+	/*
+	 * Ordered: each of .data and .bss from a page boundary, as the ld
+	 * fragment aligns them, and weighed against its own hot globals now.
+	 * A section is only ordered when that takes no more pages and saves
+	 * lines or pages or separates write-hot lines from other data.
+	 */
+	qsort(pl, npl, sizeof(*pl), oplace_cmp);
+	for (nd = 0; nd < npl && !pl[nd].obj->sec->nobits; nd++)
+		;
+	k = 0;
+	for (b = 0; b < 2; b++) {
+		lo = b == 0 ? 0 : nd;
+		hi = b == 0 ? nd : npl;
+		if (lo == hi)
+			continue;
+		plines = ppages = 0;
+		off = 0;
+		lastline = lastpage = (Dwarf_Addr)-1;
+		for (i = lo; i < hi; i++) {
+			o = pl[i].obj;
+			if (i > lo && pl[i - 1].kind != pl[i].kind)
+				off = roundup(off, cachelinesize);
+			off = roundup(off, MIN(o->align, 64));
+			pl[i].off = off;
+			count_span(off, o->size, cachelinesize, &lastline,
+			    &plines);
+			count_span(off, o->size, pagesize, &lastpage, &ppages);
+			off += o->size;
+		}
+		keep = ppages <= npages[b] && (plines < nlines[b] ||
+		    ppages < npages[b] || nshared[b] > 0);
+		printf("/* order: %s: now %zu cachelines and %zu pages, %zu "
+		    "lines shared by write-hot and other data; ordered, %zu "
+		    "cachelines and %zu pages%s */\n", b ? ".bss" : ".data",
+		    nlines[b], npages[b], nshared[b], plines, ppages,
+		    keep ? "" : "; left as is");
+		if (keep) {
+			memmove(&pl[k], &pl[lo], (hi - lo) * sizeof(*pl));
+			k += hi - lo;
+		}
+	}
+	if (k == 0) {
+		printf("/* order: ordering would not improve .data or .bss%s "
+		    "*/\n", orderfile != NULL ? "; nothing written" : "");
+		goto out;
+	}
+
+	if (orderfile != NULL) {
+		order_write(orderfile, pl, k);
+		printf("/* order: wrote %zu symbols to %s */\n", k,
+		    orderfile);
+	} else {
+		printf("/* order:");
+		for (i = 0; i < k; i++)
+			printf("%s %s", i > 0 ? "," : "", pl[i].sym);
+		printf(" */\n");
+	}
+out:
+	free(pl);
+	free(objs);
+}
+
+/*
+ * Startup relocation cost: dynamic relocations (.rela.dyn, .relr.dyn) are
+ * attributed to the global, and for structs the member, they patch.  Each
+ * relocated page becomes private and dirty in every process.
+ */
+struct robj {
+	const char	*name;
+	char		 type[128];	/* Arrays of structs count as the struct */
+	Dwarf_Addr	 addr;
+	Dwarf_Word	 size;
+	Dwarf_Word	 elemsize;
+	const struct layout *layout;
+};
+
+struct rhit {
+	const char	*type;
+	const char	*member;
+	Dwarf_Addr	 page;
+	const struct robj *obj;
+};
+
+static int
+robj_cmp(const void *a, const void *b)
+{
+	const struct robj *ra = a, *rb = b;
+
+	if (ra->addr != rb->addr)
+		return (ra->addr < rb->addr ? -1 : 1);
+	/* DWARF variables (with a type) before bare symbols. */
+	return ((ra->layout == NULL) - (rb->layout == NULL));
+}
+
+static int
+rhit_cmp(const void *a, const void *b)
+{
+	const struct rhit *ha = a, *hb = b;
+	int rc;
+
+	if ((rc = strcmp(ha->type, hb->type)) != 0)
+		return (rc);
+	if ((rc = strcmp(ha->member, hb->member)) != 0)
+		return (rc);
+	return (ha->page < hb->page ? -1 : ha->page > hb->page);
+}
+
+static int
+rhit_page_cmp(const void *a, const void *b)
+{
+	const struct rhit *ha = a, *hb = b;
+	int rc;
+
+	if ((rc = strcmp(ha->type, hb->type)) != 0)
+		return (rc);
+	return (ha->page < hb->page ? -1 : ha->page > hb->page);
+}
+
+struct rsum {
+	const char	*type;
+	size_t		 n, npages, nobj;
+};
+
+static int
+rsum_cmp(const void *a, const void *b)
+{
+	const struct rsum *sa = a, *sb = b;
+
+	if (sa->n != sb->n)
+		return (sa->n > sb->n ? -1 : 1);
+	return (strcmp(sa->type, sb->type));
+}
+
+static int
+ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)*(const void *const *)a;
+	uintptr_t y = (uintptr_t)*(const void *const *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static const struct robj *
+robj_find(const struct robj *objs, size_t n, Dwarf_Addr addr)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (objs[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* Objects don't nest; the last one starting at or before 'addr'. */
+	if (lo == 0 || addr >= objs[lo - 1].addr + objs[lo - 1].size)
+		return (NULL);
+	while (lo > 1 && objs[lo - 2].addr == objs[lo - 1].addr)
+		lo--;
+	return (&objs[lo - 1]);
+}
+
+static const char *
+robj_member(const struct robj *o, Dwarf_Addr addr)
+{
+	const struct member *mem;
+	Dwarf_Word off;
+	unsigned i;
+
+	if (o->layout == NULL)
+		return ("");
+	off = (addr - o->addr) % MAX(o->elemsize, 1);
+	for (i = 0; i < o->layout->nmembers; i++) {
+		mem = &o->layout->members[i];
+		if (off >= mem->offset && off < mem->offset + mem->size)
+			return (mem->name);
+	}
+	return ("");
+}
+
+static void
+report_relocs_globals(void)
+{
+	struct robj *objs, *o;
+	struct rhit *hits;
+	struct rsum *sums;
+	const struct robj *ro, **objp;
+	size_t i, j, k, n, nhits, nsums, npages, unattributed;
+	Dwarf_Addr lastpage;
+
+	objs = xcalloc(nglobals + nsymbols + 1, sizeof(*objs));
+	n = 0;
+	for (i = 0; i < nglobals; i++) {
+		if (!globals[i].hasaddr || globals[i].size == 0)
+			continue;
+		o = &objs[n++];
+		o->name = globals[i].name;
+		if (globals[i].layout != NULL)
+			snprintf(o->type, sizeof(o->type), "struct %s",
+			    globals[i].layout->name);
+		else
+			snprintf(o->type, sizeof(o->type), "%s",
+			    globals[i].type_name);
+		o->addr = globals[i].addr;
+		o->size = globals[i].size;
+		o->elemsize = globals[i].layout != NULL ?
+		    globals[i].layout->size : globals[i].size;
+		o->layout = globals[i].layout;
+	}
+	for (i = 0; i < nsymbols; i++) {
+		o = &objs[n++];
+		o->name = symbols[i].name;
+		snprintf(o->type, sizeof(o->type), "symbol %s", o->name);
+		o->addr = symbols[i].addr;
+		o->size = o->elemsize = symbols[i].size;
+	}
+	qsort(objs, n, sizeof(*objs), robj_cmp);
+
+	hits = xcalloc(MAX(nrelocs, 1), sizeof(*hits));
+	nhits = unattributed = 0;
+	for (i = 0; i < nrelocs; i++) {
+		if ((ro = robj_find(objs, n, relocs[i])) == NULL) {
+			unattributed++;
+			continue;
+		}
+		hits[nhits].obj = ro;
+		hits[nhits].type = ro->type;
+		hits[nhits].member = robj_member(ro, relocs[i]);
+		hits[nhits].page = relocs[i] / pagesize;
+		nhits++;
+	}
+
+	/* Pages dirtied, overall. */
+	if (nrelocs > 0)
+		qsort(relocs, nrelocs, sizeof(*relocs), addr_cmp);
+	npages = 0;
+	for (i = 0; i < nrelocs; i++)
+		if (i == 0 || relocs[i] / pagesize !=
+		    relocs[i - 1] / pagesize)
+			npages++;
+	printf("/* relocs: %zu dynamic relocations dirty %zu pages; %zu "
+	    "not in a known global */\n", nrelocs, npages, unattributed);
+
+	/* Per type: relocations, globals and pages, most relocated first. */
+	qsort(hits, nhits, sizeof(*hits), rhit_page_cmp);
+	sums = xcalloc(MAX(nhits, 1), sizeof(*sums));
+	objp = xcalloc(MAX(nhits, 1), sizeof(*objp));
+	nsums = 0;
+	for (i = 0; i < nhits; i = j) {
+		sums[nsums].type = hits[i].type;
+		lastpage = (Dwarf_Addr)-1;
+		for (j = i; j < nhits && strcmp(hits[j].type,
+		    hits[i].type) == 0; j++) {
+			if (hits[j].page != lastpage) {
+				sums[nsums].npages++;
+				lastpage = hits[j].page;
+			}
+			objp[j - i] = hits[j].obj;
+		}
+		qsort(objp, j - i, sizeof(*objp), ptr_cmp);
+		for (k = 0; k < j - i; k++)
+			if (k == 0 || objp[k] != objp[k - 1])
+				sums[nsums].nobj++;
+		sums[nsums++].n = j - i;
+	}
+	qsort(sums, nsums, sizeof(*sums), rsum_cmp);
+	for (i = 0; i < nsums; i++)
+		printf("/* relocs: %s: %zu relocation%s, %zu page%s, in %zu "
+		    "global%s */\n", sums[i].type, sums[i].n,
+		    sums[i].n == 1 ? "" : "s", sums[i].npages,
+		    sums[i].npages == 1 ? "" : "s", sums[i].nobj,
+		    sums[i].nobj == 1 ? "" : "s");
+	free(objp);
+	free(sums);
+
+	/* Per struct member. */
+	qsort(hits, nhits, sizeof(*hits), rhit_cmp);
+	for (i = 0; i < nhits; i = j) {
+		for (j = i; j < nhits && strcmp(hits[j].type,
+		    hits[i].type) == 0 && strcmp(hits[j].member,
+		    hits[i].member) == 0; j++)
+			;
+		if (hits[i].member[0] == '\0')
+			continue;
+		printf("/* relocs: %s.%s: %zu relocation%s */\n",
+		    hits[i].type, hits[i].member, j - i,
+		    j - i == 1 ? "" : "s");
+	}
+	free(hits);
+	free(objs);
+}
+
+/*
+ * jemalloc-style allocator size classes: 8, 16 to 128 in steps of 16, then
+ * four classes per doubling (160, 192, 224, 256, 320, ...).  Returns the
+ * largest class below 'size', or 0.
+ */
+static Dwarf_Word
+size_class_below(Dwarf_Word size)
+{
+	Dwarf_Word c, next, step;
+
+	if (size <= 8)
+		return (0);
+	for (c = 8;; c = next) {
+		if (c < 128)
+			next = c < 16 ? 16 : c + 16;
+		else {
+			for (step = 128; step * 2 <= c; step *= 2)
+				;
+			next = c + step / 4;
+		}
+		if (next >= size)
+			return (c);
+	}
+}
+
+struct hole {
+	Dwarf_Word	 off, len;
+};
+
+/*
+ * Try to get 'lay' to 'target' bytes by moving its last members into the
+ * holes before them, best fit first.  Prints the moves; returns the size
+ * reached.
+ */
+static Dwarf_Word
+nearmiss_moves(const struct layout *lay, const struct hole *holes0,
+    unsigned nholes, Dwarf_Word target, bool print)
+{
+	const struct member *mem;
+	struct hole *holes;
+	Dwarf_Word *newoff, end, size, off;
+	unsigned i, j, last;
+	bool *moved;
+
+	holes = xcalloc(MAX(nholes, 1), sizeof(*holes));
+	memcpy(holes, holes0, nholes * sizeof(*holes));
+	newoff = xcalloc(lay->nmembers, sizeof(*newoff));
+	moved = xcalloc(lay->nmembers, sizeof(*moved));
+	for (i = 0; i < lay->nmembers; i++)
+		newoff[i] = lay->members[i].offset;
+
+	size = lay->size;
+	while (size > target) {
+		/* The member ending last decides the size. */
+		last = 0;
+		for (i = 1; i < lay->nmembers; i++)
+			if (newoff[i] + lay->members[i].size >=
+			    newoff[last] + lay->members[last].size)
+				last = i;
+		mem = &lay->members[last];
+		if (moved[last] || mem->size == 0)
+			break;
+
+		/* Best fit among the holes before it. */
+		j = nholes;
+		for (i = 0; i < nholes; i++) {
+			if (holes[i].off + holes[i].len > mem->offset ||
+			    roundup(holes[i].off, MAX(mem->align, 1)) +
+			    mem->size > holes[i].off + holes[i].len)
+				continue;
+			if (j == nholes || holes[i].len < holes[j].len)
+				j = i;
+		}
+		if (j == nholes)
+			break;
+		off = roundup(holes[j].off, MAX(mem->align, 1));
+
+		/* What is left of the hole before the member is lost. */
+		holes[j].len -= off + mem->size - holes[j].off;
+		holes[j].off = off + mem->size;
+		newoff[last] = off;
+		moved[last] = true;
+
+		end = 0;
+		for (i = 0; i < lay->nmembers; i++)
+			end = MAX(end, newoff[i] + lay->members[i].size);
+		size = roundup(end, MAX(lay->align, 1));
+		if (print)
+			printf("/* nearmiss: move %s (%ju bytes) from %ju into "
+			    "the hole at %ju -> %ju bytes */\n", mem->name,
+			    (uintmax_t)mem->size, (uintmax_t)mem->offset,
+			    (uintmax_t)off, (uintmax_t)size);
+	}
+	free(moved);
+	free(newoff);
+	free(holes);
+	return (size);
+}
+
+/*
+ * Copy of 'lay' with each unit of layout_units() holding several members
+ * made one member, named after them ("x,a:3,b:5").
+ */
+static struct layout *
+layout_collapse(const struct layout *lay)
+{
+	struct layout *nl;
+	struct member *mem;
+	const struct member *om;
+	struct unit *units;
+	unsigned i, j, nunits;
+	size_t len;
+
+	units = layout_units(lay, NULL, &nunits);
+	nl = xcalloc(1, sizeof(*nl));
+	nl->name = xstrdup(lay->name);
+	nl->size = lay->size;
+	nl->align = lay->align;
+	nl->nmembers = nunits;
+	nl->members = xcalloc(MAX(nunits, 1), sizeof(*nl->members));
+	for (i = 0; i < nunits; i++) {
+		mem = &nl->members[i];
+		*mem = lay->members[units[i].first];
+		mem->sub = NULL;
+		mem->type_name = xstrdup(mem->type_name);
+		if (units[i].n == 1) {
+			mem->name = xstrdup(mem->name);
+			continue;
+		}
+		len = 1;
+		for (j = 0; j < units[i].n; j++)
+			len += strlen(lay->members[units[i].first + j].name) +
+			    16;
+		mem->name = xcalloc(len, 1);
+		for (j = 0; j < units[i].n; j++) {
+			om = &lay->members[units[i].first + j];
+			snprintf(mem->name + strlen(mem->name),
+			    len - strlen(mem->name), (om->flags &
+			    MEM_BITFIELD) != 0 ? "%s%s:%u" : "%s%s",
+			    j > 0 ? "," : "", om->name, om->bitsize);
+		}
+		mem->offset = units[i].start;
+		mem->size = units[i].end - units[i].start;
+		mem->align = units[i].align;
+		mem->flags &= ~MEM_BITFIELD;
+		mem->bitoff = mem->bitsize = 0;
+	}
+	free(units);
+	return (nl);
+}
+
+/*
+ * "nearmiss": structs at most 'nearmiss' (-n) bytes over a multiple of the
+ * cacheline or over an allocator size class, where getting rid of a hole or
+ * two saves a whole line or class.  Lists the holes and either the member
+ * moves into them or the packed-by-alignment layout that gets the struct
+ * under.  Size classes are only reported when reachable by reordering;
+ * there are too many of them to be worth a line otherwise.  Bitfields move
+ * with their storage unit (layout_collapse()); unions (members that still
+ * overlap) are not reordered.
+ */
+static void
+report_nearmiss(const struct layout *lay)
+{
+	struct layout *packed, *units;
+	struct hole *holes;
+	Dwarf_Word targets[2], lastend, over, size, line, class;
+	unsigned *order, i, nholes, ntargets;
+	const char *sep;
+	bool overlap;
+
+	if (lay->nevars > 0 || lay->nmembers == 0)
+		return;
+
+	units = layout_collapse(lay);
+	holes = xcalloc(units->nmembers + 1, sizeof(*holes));
+	nholes = 0;
+	lastend = 0;
+	overlap = false;
+	for (i = 0; i < units->nmembers; i++) {
+		if (units->members[i].offset < lastend) {
+			overlap = true;
+			break;
+		}
+		if (units->members[i].offset > lastend) {
+			holes[nholes].off = lastend;
+			holes[nholes++].len = units->members[i].offset -
+			    lastend;
+		}
+		lastend = units->members[i].offset + units->members[i].size;
+	}
+
+	order = xcalloc(lay->nmembers, sizeof(*order));
+	for (i = 0; i < lay->nmembers; i++)
+		order[i] = i;
+	order_by_align(lay, order, lay->nmembers);
+	packed = layout_repack(lay, order, NULL);
+
+	/* Lowest first. */
+	ntargets = 0;
+	line = lay->size - lay->size % cachelinesize;
+	class = size_class_below(lay->size);
+	if (overlap || packed->size > class || lay->size - class > nearmiss)
+		class = 0;
+	if (class > 0 && class < line)
+		targets[ntargets++] = class;
+	if (line > 0 && line < lay->size && lay->size - line <= nearmiss)
+		targets[ntargets++] = line;
+	if (class > line)
+		targets[ntargets++] = class;
+	if (ntargets == 0)
+		goto out;
+
+	for (i = 0; i < ntargets; i++) {
+		over = lay->size - targets[i];
+		if (targets[i] == line)
+			printf("/* nearmiss: %s: %ju bytes, %ju over %ju "
+			    "(cachelines: %ju -> %ju) */\n", lay->name,
+			    (uintmax_t)lay->size, (uintmax_t)over,
+			    (uintmax_t)targets[i],
+			    (uintmax_t)howmany(lay->size, cachelinesize),
+			    (uintmax_t)(targets[i] / cachelinesize));
+		else
+			printf("/* nearmiss: %s: %ju bytes, %ju over the "
+			    "%ju-byte size class */\n", lay->name,
+			    (uintmax_t)lay->size, (uintmax_t)over,
+			    (uintmax_t)targets[i]);
+	}
+	if (overlap) {
+		printf("/* nearmiss: members overlap (union); not reordered "
+		    "*/\n");
+		goto out;
+	}
+
+	printf("/* nearmiss: holes: ");
+	sep = "";
+	for (i = 0; i < nholes; i++) {
+		printf("%s%ju at %ju", sep, (uintmax_t)holes[i].len,
+		    (uintmax_t)holes[i].off);
+		sep = ", ";
+	}
+	printf("%s%s%ju bytes tail padding */\n", nholes == 0 ? "none" : "",
+	    nholes == 0 ? "; " : ", ", (uintmax_t)(lay->size - lastend));
+
+	/* Aim for the lowest target the struct can reach. */
+	for (i = 0; i < ntargets; i++) {
+		size = nearmiss_moves(units, holes, nholes, targets[i], false);
+		if (size <= targets[i]) {
+			nearmiss_moves(units, holes, nholes, targets[i], true);
+			break;
+		}
+		if (packed->size <= targets[i]) {
+			printf("/* nearmiss: packed by alignment: %ju bytes "
+			    "*/\n", (uintmax_t)packed->size);
+			layout_print(packed);
+			break;
+		}
+	}
+	if (i == ntargets)
+		printf("/* nearmiss: no reorder gets it under %ju bytes "
+		    "(packed: %ju); %ju bytes of members must go */\n",
+		    (uintmax_t)targets[ntargets - 1], (uintmax_t)packed->size,
+		    (uintmax_t)(packed->size - targets[ntargets - 1]));
+
+out:
+	layout_free(packed);
+	layout_free(units);
+	free(order);
+	free(holes);
+}
+
+/*
+ * Size, alignment and name of a member to insert, from an -i spec:
+ * "[name=]type", where the type is one of the struct's member types or a
+ * scalar, pointer or array spelling, or "[name=]size[/align]".
+ */
+static bool
+insert_resolve(const struct layout *lay, const char *spec, unsigned idx,
+    struct member *mem)
+{
+	const char *eq, *t;
+	char *end, name[64], type[32];
+	unsigned i;
+
+	memset(mem, 0, sizeof(*mem));
+	if ((eq = strchr(spec, '=')) != NULL) {
+		snprintf(name, sizeof(name), "%.*s", (int)(eq - spec), spec);
+		t = eq + 1;
+	} else {
+		snprintf(name, sizeof(name), "new%u", idx);
+		t = spec;
+	}
+
+	if (isdigit((unsigned char)t[0])) {
+		mem->size = strtoull(t, &end, 0);
+		if (*end == '/')
+			mem->align = strtoul(end + 1, &end, 0);
+		else
+			for (mem->align = 1; mem->align * 2 <= max_scalar_align &&
+			    mem->size % (mem->align * 2) == 0; mem->align *= 2)
+				;
+		if (*end != '\0' || mem->size == 0 || mem->align == 0 ||
+		    !powerof2(mem->align))
+			errx(EX_USAGE, "invalid member size: %s", spec);
+		snprintf(type, sizeof(type), "char[%ju]",
+		    (uintmax_t)mem->size);
+		t = type;
+	} else {
+		for (i = 0; i < lay->nmembers; i++)
+			if (strcmp(lay->members[i].type_name, t) == 0)
+				break;
+		if (i < lay->nmembers) {
+			*mem = lay->members[i];
+			mem->sub = NULL;
+		} else if ((mem->size = dump_type_size(t, mem)) == 0) {
+			printf("/* insert: unknown type '%s'; give its size as "
+			    "size[/align] */\n", t);
+			return (false);
+		}
+		if (mem->align == 0)
+			mem->align = 1;
+	}
+	mem->name = xstrdup(name);
+	mem->type_name = xstrdup(t);
+	mem->offset = 0;
+	return (true);
+}
+
+/*
+ * Copy of 'lay' with 'mem' (if not NULL) inserted after the first 'pos'
+ * members, at the first suitably aligned offset.  The members after it keep
+ * their offsets where they can and are pushed back (at their alignment)
+ * where they must; a bitfield's unit (layout_units()) is pushed as a whole.
+ * 'pos' must not split a unit.
+ */
+static struct layout *
+layout_insert(const struct layout *lay, const struct member *mem,
+    unsigned pos)
+{
+	struct layout *nl;
+	struct member *m;
+	struct unit *units, *u;
+	Dwarf_Word end, shift;
+	unsigned *unit, i, k, nunits;
+
+	nl = xcalloc(1, sizeof(*nl));
+	nl->name = xstrdup(lay->name);
+	if (mem == NULL)
+		pos = lay->nmembers;
+	nl->align = mem != NULL ? MAX(lay->align, mem->align) : lay->align;
+	nl->nmembers = lay->nmembers + (mem != NULL);
+	nl->members = xcalloc(nl->nmembers, sizeof(*nl->members));
+
+	unit = xcalloc(MAX(lay->nmembers, 1), sizeof(*unit));
+	units = layout_units(lay, unit, &nunits);
+	end = shift = 0;
+	for (i = 0; i < nl->nmembers; i++) {
+		m = &nl->members[i];
+		k = i < pos ? i : i - 1;
+		if (i == pos && mem != NULL)
+			*m = *mem;
+		else
+			*m = lay->members[k];
+		m->name = xstrdup(m->name);
+		m->type_name = xstrdup(m->type_name);
+		m->sub = NULL;
+		if (i == pos && mem != NULL)
+			m->offset = roundup(end, MAX(m->align, 1));
+		else if (i > pos && mem != NULL) {
+			u = &units[unit[k]];
+			if (k == u->first)
+				shift = MAX(u->start, roundup(end, u->align)) -
+				    u->start;
+			m->offset += shift;
+		}
+		end = MAX(end, m->offset + m->size);
+	}
+	nl->size = MAX(lay->size, roundup(end, MAX(nl->align, 1)));
+	nl->hash = layout_hash(nl);
+	free(units);
+	free(unit);
+	return (nl);
+}
+
+/*
+ * Hot members: annotated "hot", or, without annotations ('*annotated' set
+ * to false), the members on the first cacheline.
+ */
+static bool *
+hot_members(const struct layout *lay, bool *annotated)
+{
+	const struct annot *an;
+	bool *hot, any;
+	unsigned i;
+
+	hot = xcalloc(MAX(lay->nmembers, 1), sizeof(*hot));
+	any = false;
+	for (i = 0; i < lay->nmembers; i++) {
+		an = annot_find(lay->name, lay->members[i].name);
+		if (an != NULL && (an->flags & ANNOT_HOT) != 0)
+			hot[i] = any = true;
+	}
+	if (!any)
+		for (i = 0; i < lay->nmembers; i++)
+			hot[i] = member_on_line(&lay->members[i], 0);
+	if (annotated != NULL)
+		*annotated = any;
+	return (hot);
+}
+
+struct inscand {
+	unsigned	 pos;
+	struct layout	*res;
+	Dwarf_Word	 growth;
+	Dwarf_Word	 lines;
+	unsigned	 hotmoved;
+	unsigned	 moved;		/* Members at a new offset */
+};
+
+static int
+inscand_cmp(const void *a, const void *b)
+{
+	const struct inscand *ca = a, *cb = b;
+
+	if (ca->growth != cb->growth)
+		return (ca->growth < cb->growth ? -1 : 1);
+	if (ca->lines != cb->lines)
+		return (ca->lines < cb->lines ? -1 : 1);
+	if (ca->hotmoved != cb->hotmoved)
+		return (ca->hotmoved < cb->hotmoved ? -1 : 1);
+	if (ca->moved != cb->moved)
+		return (ca->moved < cb->moved ? -1 : 1);
+	return (ca->pos < cb->pos ? -1 : ca->pos > cb->pos);
+}
+
+#define	INSERT_SHOW	5		/* Candidates listed per new member */
+
+/*
+ * "insert" (-i): where to add new members without growing the struct.
+ * Every gap between members, and the tail, is a candidate; they are ranked
+ * by size growth, cacheline growth and the number of hot members pushed
+ * onto another cacheline.  The new members are placed one after the other,
+ * each at its best candidate, and the result is printed.
+ */
+static void
+report_insert(const struct layout *lay)
+{
+	struct layout *cur, *next;
+	struct inscand *cands;
+	struct member mem, *mems;
+	const struct member *om, *nm;
+	struct unit *units;
+	Dwarf_Word startlines;
+	unsigned *unit, i, j, k, n, nmems, nunits, show;
+	bool *hot;
+
+	if (lay->nevars > 0)
+		return;
+	units = layout_units(lay, NULL, &nunits);
+	for (i = 1; i < nunits; i++)
+		if (units[i].start < units[i - 1].end)
+			break;
+	free(units);
+	if (i < nunits) {
+		printf("/* insert: %s: members overlap (union) */\n",
+		    lay->name);
+		return;
+	}
+
+	/* Placed by decreasing alignment, which wastes the least. */
+	mems = xcalloc(inserts.n, sizeof(*mems));
+	nmems = 0;
+	for (k = 0; k < inserts.n; k++) {
+		if (!insert_resolve(lay, inserts.v[k], k, &mems[nmems]))
+			continue;
+		for (j = nmems; j > 0 && mems[j - 1].align <
+		    mems[nmems].align; j--)
+			;
+		mem = mems[nmems];
+		memmove(&mems[j + 1], &mems[j], (nmems - j) * sizeof(*mems));
+		mems[j] = mem;
+		nmems++;
+	}
+
+	cur = layout_insert(lay, NULL, 0);
+	startlines = howmany(lay->size, cachelinesize);
+	for (k = 0; k < nmems; k++) {
+		mem = mems[k];
+		hot = hot_members(cur, NULL);
+
+		/* Every gap between units is a candidate. */
+		unit = xcalloc(MAX(cur->nmembers, 1), sizeof(*unit));
+		free(layout_units(cur, unit, &nunits));
+		cands = xcalloc(cur->nmembers + 1, sizeof(*cands));
+		n = 0;
+		for (i = 0; i <= cur->nmembers; i++) {
+			if (i > 0 && i < cur->nmembers &&
+			    unit[i] == unit[i - 1])
+				continue;
+			cands[n].pos = i;
+			cands[n].res = layout_insert(cur, &mem, i);
+			cands[n].growth = cands[n].res->size - cur->size;
+			cands[n].lines = howmany(cands[n].res->size,
+			    cachelinesize) - howmany(cur->size, cachelinesize);
+			for (j = 0; j < cur->nmembers; j++) {
+				om = &cur->members[j];
+				nm = &cands[n].res->members[j < i ? j : j + 1];
+				if (om->offset == nm->offset)
+					continue;
+				cands[n].moved++;
+				if (hot[j] && (om->offset / cachelinesize !=
+				    nm->offset / cachelinesize ||
+				    (om->offset + MAX(om->size, 1) - 1) /
+				    cachelinesize != (nm->offset +
+				    MAX(nm->size, 1) - 1) / cachelinesize))
+					cands[n].hotmoved++;
+			}
+			n++;
+		}
+		free(unit);
+		qsort(cands, n, sizeof(*cands), inscand_cmp);
+
+		printf("/* insert: %s %s (%ju bytes, align %u) into %s "
+		    "(%ju bytes) */\n", mem.type_name, mem.name,
+		    (uintmax_t)mem.size, mem.align, lay->name,
+		    (uintmax_t)cur->size);
+		show = MIN(n, INSERT_SHOW);
+		for (i = 0; i < show; i++) {
+			j = cands[i].pos;
+			nm = &cands[i].res->members[j];
+			printf("/* insert: %u. at %ju, ", i + 1,
+			    (uintmax_t)nm->offset);
+			if (j == cur->nmembers)
+				printf("at the end");
+			else if (j == 0)
+				printf("first");
+			else
+				printf("after %s", cur->members[j - 1].name);
+			printf(": %+jd bytes, %+jd cachelines, %u hot "
+			    "moved */\n", (intmax_t)cands[i].growth,
+			    (intmax_t)cands[i].lines, cands[i].hotmoved);
+		}
+
+		next = cands[0].res;
+		cands[0].res = NULL;
+		for (i = 0; i < n; i++)
+			if (cands[i].res != NULL)
+				layout_free(cands[i].res);
+		free(cands);
+		free(hot);
+		free(mem.name);
+		free(mem.type_name);
+		layout_free(cur);
+		cur = next;
+	}
+
+	if (cur->nmembers > lay->nmembers) {
+		printf("/* insert: with %u new member%s: %+jd bytes, "
+		    "cachelines: %ju -> %ju */\n",
+		    cur->nmembers - lay->nmembers,
+		    cur->nmembers - lay->nmembers == 1 ? "" : "s",
+		    (intmax_t)cur->size - (intmax_t)lay->size,
+		    (uintmax_t)startlines,
+		    (uintmax_t)howmany(cur->size, cachelinesize));
+		layout_print(cur);
+	}
+	layout_free(cur);
+	free(mems);
+}
+
+/*
+ * Largest power of two (up to 'max') that divides 'off'.
+ */
+static unsigned
+offset_align(Dwarf_Word off, unsigned max)
+{
+	unsigned a;
+
+	for (a = 1; a < max && off % (a * 2) == 0; a *= 2)
+		;
+	return (a);
+}
+
+static bool
+arith_encoding(int enc)
+{
+
+	switch (enc) {
+	case DW_ATE_float:
+	case DW_ATE_signed:
+	case DW_ATE_signed_char:
+	case DW_ATE_unsigned:
+	case DW_ATE_unsigned_char:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+static const unsigned simd_widths[] = { 16, 32, 64 };
+
+/*
+ * "simd": arrays of arithmetic scalars, at least 16 bytes, as processed
+ * with SSE/NEON (16), AVX2 (32) or AVX-512 (64 bytes) loads.  For each
+ * width up to the array size, tells whether the array is aligned for it:
+ * its offset must be a multiple of the width and so must the struct's own
+ * alignment, or nothing holds for the address.  Lists arrays straddling
+ * more cachelines than their size needs (with the struct at a line
+ * boundary) and the padding that would align each one; then proposes a
+ * layout with every such array aligned to its widest load, placed first.
+ */
+static void
+report_simd(const struct layout *lay)
+{
+	const struct member *mem;
+	struct layout *copy, *nl;
+	Dwarf_Word first, last;
+	unsigned *order, i, j, w, want, guaranteed, nfix;
+	const char *sep;
+
+	if (lay->nevars > 0)
+		return;
+	copy = layout_insert(lay, NULL, 0);
+	nfix = 0;
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		if ((mem->flags & (MEM_ARRAY | MEM_POINTER | MEM_AGGR)) !=
+		    MEM_ARRAY || !arith_encoding(mem->encoding) ||
+		    mem->size < simd_widths[0])
+			continue;
+
+		guaranteed = MIN(offset_align(mem->offset, 64),
+		    MAX(lay->align, 1));
+		want = 0;
+		printf("/* simd: %s (%s, %ju bytes) at %ju, aligned to %u (",
+		    mem->name, mem->type_name, (uintmax_t)mem->size,
+		    (uintmax_t)mem->offset, guaranteed);
+		sep = "";
+		for (j = 0; j < nitems(simd_widths); j++) {
+			w = simd_widths[j];
+			if (w > mem->size)
+				break;
+			want = w;
+			printf("%s%u: %s", sep, w, guaranteed >= w ? "yes" :
+			    mem->offset % w == 0 ? "offset only" : "no");
+			sep = ", ";
+		}
+		printf(") */\n");
+
+		first = mem->offset / cachelinesize;
+		last = (mem->offset + mem->size - 1) / cachelinesize;
+		if (last - first + 1 > howmany(mem->size, cachelinesize))
+			printf("/* simd: %s: straddles cachelines %ju-%ju, "
+			    "%ju would do */\n", mem->name, (uintmax_t)first,
+			    (uintmax_t)last,
+			    (uintmax_t)howmany(mem->size, cachelinesize));
+
+		if (guaranteed >= want)
+			continue;
+		if (mem->offset % want != 0)
+			printf("/* simd: %s: %ju bytes of padding before it "
+			    "would align it for %u-byte loads */\n", mem->name,
+			    (uintmax_t)(roundup(mem->offset, want) -
+			    mem->offset), want);
+		copy->members[i].align = MAX(copy->members[i].align, want);
+		copy->align = MAX(copy->align, want);
+		nfix++;
+	}
+
+	if (nfix > 0) {
+		order = xcalloc(copy->nmembers, sizeof(*order));
+		for (i = 0; i < copy->nmembers; i++)
+			order[i] = i;
+		order_by_align(copy, order, copy->nmembers);
+		nl = layout_repack(copy, order, NULL);
+		printf("/* simd: proposed layout, alignas(%u), %+jd bytes, "
+		    "cachelines: %ju -> %ju */\n", nl->align,
+		    (intmax_t)nl->size - (intmax_t)lay->size,
+		    (uintmax_t)howmany(lay->size, cachelinesize),
+		    (uintmax_t)howmany(nl->size, cachelinesize));
+		layout_print(nl);
+		layout_free(nl);
+		free(order);
+	}
+	layout_free(copy);
+}
+
+/*
+ * Atomic wrapper types, matched against the type name: C++ std::atomic,
+ * Linux atomic_t and friends, Rust's Atomic*.
+ */
+static const char *atomic_types[] = {
+	"atomic<*>", "__atomic_base<*>", "__atomic_float<*>", "atomic_ref<*>",
+	"atomic_flag", "atomic_t", "atomic64_t", "atomic_long_t",
+	"refcount_t", "Atomic[A-Z]*",
+};
+
+static bool
+member_atomic(const struct layout *lay, const struct member *mem)
+{
+	static const char *prefixes[] = {
+		"const ", "volatile ", "struct ", "union ",
+	};
+	const struct annot *an;
+	const char *t;
+	size_t i;
+
+	if ((mem->flags & MEM_ATOMIC) != 0)
+		return (true);
+	an = annot_find(lay->name, mem->name);
+	if (an != NULL && (an->flags & ANNOT_ATOMIC) != 0)
+		return (true);
+	if ((mem->flags & MEM_POINTER) != 0)
+		return (false);
+	t = mem->type_name;
+	for (i = 0; i < nitems(prefixes); i++)
+		if (strncmp(t, prefixes[i], strlen(prefixes[i])) == 0)
+			t += strlen(prefixes[i]);
+	for (i = 0; i < nitems(atomic_types); i++)
+		if (fnmatch(atomic_types[i], t, 0) == 0)
+			return (true);
+	return (false);
+}
+
+/*
+ * Of the 'npos' placements of the struct at multiples of 'stride' from a
+ * cacheline boundary, how many put an element of the member across a line.
+ */
+static unsigned
+straddle_count(Dwarf_Word off, Dwarf_Word esize, Dwarf_Word nelems,
+    Dwarf_Word stride, unsigned npos)
+{
+	Dwarf_Word base, j, pos;
+	unsigned k, n;
+
+	n = 0;
+	nelems = MIN(nelems, cachelinesize);
+	for (k = 0; k < npos; k++) {
+		base = k * stride;
+		for (j = 0; j < nelems; j++) {
+			pos = (base + off + j * esize) % cachelinesize;
+			if (pos + esize > cachelinesize)
+				break;
+		}
+		if (j < nelems)
+			n++;
+	}
+	return (n);
+}
+
+/*
+ * "splitlock": atomic members (_Atomic, atomic wrapper types or annotated
+ * "atomic") of 2, 4, 8 or 16 bytes, the sizes done with locked
+ * instructions, that can straddle a cacheline: as laid out (the struct at
+ * a line boundary), in an array of the struct, at any base its DWARF
+ * alignment allows, and on the heap at malloc()'s 16-byte alignment.  A
+ * locked operation across two lines takes a bus lock, costing thousands of
+ * cycles, and some kernels trap it.  16-byte members also need 16-byte
+ * alignment for cmpxchg16b.
+ */
+static void
+report_splitlock(const struct layout *lay)
+{
+	const struct member *mem;
+	Dwarf_Word esize, nelems, mask;
+	unsigned i, align, natomic, nrisky, laid, arr, narr, any, nany, heap;
+
+	if (lay->nevars > 0)
+		return;
+	natomic = nrisky = 0;
+	align = MAX(lay->align, 1);
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		if (!member_atomic(lay, mem))
+			continue;
+		esize = mem->size;
+		nelems = 1;
+		if ((mem->flags & MEM_ARRAY) != 0 && mem->elemsize != 0) {
+			esize = mem->elemsize;
+			nelems = mem->nelems;
+		}
+		if (esize < 2 || esize > 16 || !powerof2(esize))
+			continue;
+		natomic++;
+
+		laid = straddle_count(mem->offset, esize, nelems, 0, 1);
+		narr = cachelinesize / offset_align(lay->size, cachelinesize);
+		arr = straddle_count(mem->offset, esize, nelems, lay->size,
+		    narr);
+		nany = align >= cachelinesize ? 1 : cachelinesize / align;
+		any = straddle_count(mem->offset, esize, nelems, align, nany);
+		heap = straddle_count(mem->offset, esize, nelems, 16,
+		    cachelinesize / 16);
+		mask = MIN(offset_align(mem->offset, 64), align);
+		if (laid + arr + any + heap == 0 && (esize < 16 || mask >= 16))
+			continue;
+		nrisky++;
+
+		printf("/* splitlock: %s (%s, %ju bytes) at %ju: ", mem->name,
+		    mem->type_name, (uintmax_t)esize, (uintmax_t)mem->offset);
+		if (laid + arr + any + heap == 0)
+			printf("never straddles */\n");
+		else
+			printf("straddles a cacheline as laid out: %s; in "
+			    "arrays: %u of %u elements; at align %u: %u of %u "
+			    "bases; on the heap (16-byte aligned): %u of %ju "
+			    "bases */\n", laid ? "yes" : "no", arr, narr, align,
+			    any, nany, heap, (uintmax_t)(cachelinesize / 16));
+		if (esize == 16 && mask < 16)
+			printf("/* splitlock: %s: only %ju-byte aligned; "
+			    "cmpxchg16b needs 16 */\n", mem->name,
+			    (uintmax_t)mask);
+	}
+	if (natomic > 0 && nrisky == 0)
+		printf("/* splitlock: %s: no atomic member can straddle a "
+		    "cacheline */\n", lay->name);
+	else if (nrisky > 0)
+		printf("/* splitlock: %s: align the members to their size, "
+		    "e.g. with alignas() */\n", lay->name);
+}
+
+#define	MALLOC_ALIGN	16		/* What malloc() guarantees */
+
+/*
+ * Cachelines touched by the members selected in 'sel' (all if NULL) with
+ * the struct 'base' bytes past a line boundary.
+ */
+static unsigned
+lines_touched(const struct layout *lay, const bool *sel, Dwarf_Word base)
+{
+	const struct member *mem;
+	Dwarf_Word first, last, l, nlines;
+	unsigned i, n;
+	bool *touched;
+
+	if (sel == NULL)
+		return (lay->size == 0 ? 0 : (base + lay->size - 1) /
+		    cachelinesize + 1);
+	nlines = howmany(base + lay->size, cachelinesize);
+	touched = xcalloc(MAX(nlines, 1), sizeof(*touched));
+	n = 0;
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		if (!sel[i] || mem->size == 0)
+			continue;
+		first = (base + mem->offset) / cachelinesize;
+		last = (base + mem->offset + mem->size - 1) / cachelinesize;
+		for (l = first; l <= last && l < nlines; l++)
+			if (!touched[l]) {
+				touched[l] = true;
+				n++;
+			}
+	}
+	free(touched);
+	return (n);
+}
+
+/*
+ * Lines touched at each base (multiples of 'step' below a cacheline):
+ * prints "a/b/c/d, expected x, worst y" and returns the expected count.
+ */
+static double
+print_base_lines(const struct layout *lay, const bool *sel, unsigned step,
+    unsigned *worstp)
+{
+	Dwarf_Word base;
+	unsigned n, sum, worst, nbases;
+
+	sum = worst = nbases = 0;
+	for (base = 0; base < cachelinesize; base += step) {
+		n = lines_touched(lay, sel, base);
+		printf("%s%u", base > 0 ? "/" : "", n);
+		sum += n;
+		worst = MAX(worst, n);
+		nbases++;
+	}
+	printf(", expected %.2f, worst %u", (double)sum / nbases, worst);
+	*worstp = worst;
+	return ((double)sum / nbases);
+}
+
+/*
+ * "heap": cachelines touched by a heap instance.  malloc() only guarantees
+ * 16 bytes, so an instance starts at any multiple of its alignment (at
+ * least 16) within a line, not at a line boundary as the layouts assume.
+ * Prints the lines touched by the whole struct and by its hot members
+ * (annotated "hot", or else those on the first line) at every such base,
+ * and what aligning instances to a cacheline would save.
+ */
+static void
+report_heap(const struct layout *lay)
+{
+	unsigned step, worst, hworst, n0, h0;
+	double expected, hexpected;
+	bool *hot;
+
+	if (lay->size == 0 || lay->nofields)
+		return;
+	step = MAX(lay->align, MALLOC_ALIGN);
+	if (step >= cachelinesize) {
+		printf("/* heap: %s: %u-byte aligned, instances start on a "
+		    "cacheline */\n", lay->name, lay->align);
+		return;
+	}
+	hot = hot_members(lay, NULL);
+
+	printf("/* heap: %s (%ju bytes, align %u): at bases 0", lay->name,
+	    (uintmax_t)lay->size, lay->align);
+	for (worst = step; worst < cachelinesize; worst += step)
+		printf("/%u", worst);
+	printf(": cachelines ");
+	expected = print_base_lines(lay, NULL, step, &worst);
+	printf(" */\n");
+	n0 = lines_touched(lay, NULL, 0);
+
+	h0 = 0;
+	hexpected = 0;
+	hworst = 0;
+	if (lay->nmembers > 0) {
+		printf("/* heap: hot members: cachelines ");
+		hexpected = print_base_lines(lay, hot, step, &hworst);
+		printf(" */\n");
+		h0 = lines_touched(lay, hot, 0);
+	}
+
+	if (hexpected > h0 || expected > n0)
+		printf("/* heap: aligned_alloc(%zu, ...) or alignas(%zu) saves "
+		    "%.2f lines on average (%u worst case), %.2f for the hot "
+		    "members (%u); sizeof grows by %ju bytes with alignas */\n",
+		    cachelinesize, cachelinesize, expected - n0, worst - n0,
+		    hexpected - h0, hworst - h0,
+		    (uintmax_t)(roundup(lay->size, cachelinesize) - lay->size));
+	else
+		printf("/* heap: %s: line alignment would not help */\n",
+		    lay->name);
+	free(hot);
+}
+
+/*
+ * Number of cache sets of 'cg' that the hot lines of a traversal of
+ * elements 'stride' bytes apart map to.  'hot' marks the lines of an
+ * element (relative to its start) that are touched.
+ */
+static unsigned
+sets_used(const struct cachegeom *cg, Dwarf_Word stride, const bool *hot,
+    unsigned nhot, Dwarf_Word nelems)
+{
+	Dwarf_Word a, b, t, i, period, span, addr;
+	unsigned nsets, used, l;
+	bool *set;
+
+	nsets = cg->size / cg->ways / cg->line;
+	span = (Dwarf_Word)nsets * cg->line;
+	/* The set pattern repeats once i * stride wraps around 'span'. */
+	for (a = stride, b = span; b != 0; t = a % b, a = b, b = t)
+		;
+	period = span / a;
+	set = xcalloc(nsets, sizeof(*set));
+	used = 0;
+	for (i = 0; i < MIN(period, nelems) && used < nsets; i++)
+		for (l = 0; l < nhot; l++) {
+			if (!hot[l])
+				continue;
+			addr = i * stride + (Dwarf_Word)l * cachelinesize;
+			if (!set[(addr / cg->line) % nsets]) {
+				set[(addr / cg->line) % nsets] = true;
+				used++;
+			}
+		}
+	free(set);
+	return (used);
+}
+
+/*
+ * Report the sets used by a traversal of 'nelems' elements 'stride' bytes
+ * apart (hot lines in 'hot'), for each cache level, and 4K aliasing.
+ * Returns whether anything is conflict-prone.
+ */
+static bool
+sets_print(const char *what, Dwarf_Word stride, const bool *hot,
+    unsigned nhot, Dwarf_Word nelems)
+{
+	const struct cachegeom *cg;
+	unsigned i, l, nsets, used, ideal, hotlines;
+	bool bad;
+
+	hotlines = 0;
+	for (l = 0; l < nhot; l++)
+		if (hot[l])
+			hotlines++;
+	bad = false;
+	for (i = 0; i < ngeoms; i++) {
+		cg = &geoms[i];
+		/* Strides under four lines use over a quarter of the sets. */
+		if (stride < 4 * cg->line)
+			continue;
+		nsets = cg->size / cg->ways / cg->line;
+		used = sets_used(cg, stride, hot, nhot, nelems);
+		ideal = MIN(nsets, MIN(nelems, nsets) * hotlines);
+		if (used * 4 > ideal || nelems * hotlines <= used * cg->ways)
+			continue;
+		bad = true;
+		printf("/* sets: %s: L%u (%zuK, %u-way): %u of %u sets, room "
+		    "for the hot lines of %u elements instead of %u */\n",
+		    what, i + 1, cg->size / 1024, cg->ways, used, nsets,
+		    used * cg->ways / MAX(hotlines, 1),
+		    ideal * cg->ways / MAX(hotlines, 1));
+	}
+	if (nelems > 1 && stride >= 256 && (stride % 4096 == 0 ||
+	    4096 % stride == 0)) {
+		bad = true;
+		printf("/* sets: %s: 4K aliasing between elements %ju "
+		    "apart */\n", what, (uintmax_t)(stride % 4096 == 0 ? 1 :
+		    4096 / stride));
+	}
+	return (bad);
+}
+
+/*
+ * Smallest padding, in whole cachelines so that elements stay line
+ * aligned, that avoids 4K aliasing and makes a traversal use as many sets
+ * over all cache levels as any padding up to four lines.
+ */
+static Dwarf_Word
+sets_padding(Dwarf_Word stride, const bool *hot, unsigned nhot,
+    Dwarf_Word nelems)
+{
+	Dwarf_Word pad, best, s;
+	unsigned i, score, bestscore;
+
+	best = 0;
+	bestscore = 0;
+	for (pad = cachelinesize; pad <= 4 * cachelinesize;
+	    pad += cachelinesize) {
+		s = stride + pad;
+		if (s >= 256 && (s % 4096 == 0 || 4096 % s == 0))
+			continue;
+		score = 0;
+		for (i = 0; i < ngeoms; i++)
+			score += sets_used(&geoms[i], s, hot, nhot, nelems);
+		if (score > bestscore) {
+			best = pad;
+			bestscore = score;
+		}
+	}
+	return (best);
+}
+
+/*
+ * "sets": power-of-two strides map the hot lines of consecutive elements
+ * onto a few cache sets, so a traversal thrashes them long before the
+ * cache is full, and strides that are multiples of 4K make loads falsely
+ * depend on earlier stores (4K aliasing).  Each struct is taken as an
+ * element of an array, traversed touching the lines of its members
+ * annotated "hot", or else just its first line; embedded arrays of structs
+ * are traversed touching the first line of each element.  The cache
+ * geometry comes from -G (default: 32K 8-way L1, 1M 16-way L2).  For
+ * strides that use at most a quarter of the sets, the smallest padding
+ * that spreads them is suggested.
+ */
+static void
+report_sets(const struct layout *lay)
+{
+	const struct member *mem;
+	char what[160];
+	Dwarf_Word pad, l;
+	unsigned i, nhot;
+	bool *hot, *lines, annotated, first[1] = { true };
+
+	if (lay->size == 0 || lay->nevars > 0)
+		return;
+
+	nhot = howmany(lay->size, cachelinesize);
+	lines = xcalloc(nhot, sizeof(*lines));
+	hot = hot_members(lay, &annotated);
+	lines[0] = !annotated;
+	for (i = 0; i < lay->nmembers && annotated; i++) {
+		mem = &lay->members[i];
+		if (!hot[i] || mem->size == 0)
+			continue;
+		for (l = mem->offset / cachelinesize; l <= (mem->offset +
+		    mem->size - 1) / cachelinesize && l < nhot; l++)
+			lines[l] = true;
+	}
+	snprintf(what, sizeof(what), "%s[] (%ju-byte stride)", lay->name,
+	    (uintmax_t)lay->size);
+	if (sets_print(what, lay->size, lines, nhot, UINT64_MAX)) {
+		pad = sets_padding(lay->size, lines, nhot, UINT64_MAX);
+		if (pad > 0)
+			printf("/* sets: %s: pad it by %ju bytes (to %ju) */\n",
+			    lay->name, (uintmax_t)pad,
+			    (uintmax_t)(lay->size + pad));
+	}
+
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		if ((mem->flags & MEM_AGGR) == 0 || mem->elemsize == 0 ||
+		    mem->nelems < 2)
+			continue;
+		snprintf(what, sizeof(what), "%s.%s (%ju-byte stride)",
+		    lay->name, mem->name, (uintmax_t)mem->elemsize);
+		if (!sets_print(what, mem->elemsize, first, 1, mem->nelems))
+			continue;
+		pad = sets_padding(mem->elemsize, first, 1, mem->nelems);
+		if (pad > 0)
+			printf("/* sets: %s.%s: pad the element type by %ju "
+			    "bytes (to %ju) */\n", lay->name, mem->name,
+			    (uintmax_t)pad, (uintmax_t)(mem->elemsize + pad));
+	}
+	free(hot);
+	free(lines);
+}
+
+/*
+ * Most cachelines 'bytes' bytes touch at any base that is a multiple of
+ * 'step' within a line.
+ */
+static Dwarf_Word
+worst_lines(Dwarf_Word bytes, unsigned step)
+{
+	Dwarf_Word base, worst;
+
+	worst = 0;
+	for (base = 0; base < cachelinesize; base += step)
+		worst = MAX(worst, (base + bytes - 1) / cachelinesize + 1);
+	return (worst);
+}
+
+/*
+ * "flex": structs ending in a flexible array member (or the older "[0]"
+ * and "[1]" idioms), i.e. a header followed by a variable-length payload.
+ * Reports where the payload starts, its alignment, the tail padding that
+ * malloc(sizeof + n) over-allocates, and the cachelines touched by the
+ * header plus a payload of each -P length, both with the header on a line
+ * boundary and at the worst 16-byte aligned malloc() base.  Suggests how
+ * to fit the header into one line.
+ */
+static void
+report_flex(const struct layout *lay)
+{
+	const struct member *flex, *prev;
+	struct layout *packed;
+	Dwarf_Word hdr, phdr, fixedend, bytes, best, worst, len;
+	unsigned *order, i, n, align, step;
+	const char *idiom;
+
+	if (lay->nevars > 0 || lay->nmembers == 0)
+		return;
+	flex = &lay->members[lay->nmembers - 1];
+	if ((flex->flags & MEM_ARRAY) == 0)
+		return;
+	if ((flex->flags & MEM_FLEX) != 0)
+		idiom = "flexible array member";
+	else if (flex->nelems == 0)
+		idiom = "zero-length array";
+	else if (flex->nelems == 1)
+		idiom = "one-element array";
+	else
+		return;
+
+	hdr = flex->offset;
+	prev = lay->nmembers > 1 ? &lay->members[lay->nmembers - 2] : NULL;
+	fixedend = prev != NULL ? prev->offset + prev->size : 0;
+	align = MIN(offset_align(hdr, 64), MAX(lay->align, 1));
+	printf("/* flex: %s: %s %s (%ju-byte elements) at %ju, aligned to "
+	    "%u */\n", lay->name, idiom, flex->name,
+	    (uintmax_t)flex->elemsize, (uintmax_t)hdr, align);
+	printf("/* flex: header %ju bytes, %ju of them padding before the "
+	    "payload, sizeof %ju", (uintmax_t)hdr,
+	    (uintmax_t)(hdr - fixedend), (uintmax_t)lay->size);
+	if (lay->size > hdr + flex->size)
+		printf(", %ju bytes of tail padding over-allocated by "
+		    "malloc(sizeof + n)", (uintmax_t)(lay->size - hdr -
+		    flex->size));
+	printf(" */\n");
+
+	/* Lines touched: line-aligned base vs. the worst malloc() base. */
+	step = MAX(lay->align, MALLOC_ALIGN);
+	for (i = 0; i <= npayloads; i++) {
+		len = i == 0 ? 0 : payloads[i - 1];
+		bytes = hdr + len;
+		if (bytes == 0 || (i > 0 && len == 0))
+			continue;
+		best = howmany(bytes, cachelinesize);
+		worst = worst_lines(bytes, step);
+		printf("/* flex: header + %ju payload bytes: %ju cacheline%s, "
+		    "%ju at the worst malloc() base */\n", (uintmax_t)len,
+		    (uintmax_t)best, best == 1 ? "" : "s", (uintmax_t)worst);
+	}
+
+	/* Fitting the header into one line. */
+	if (hdr > cachelinesize) {
+		n = lay->nmembers - 1;
+		order = xcalloc(lay->nmembers, sizeof(*order));
+		for (i = 0; i < n; i++)
+			order[i] = i;
+		order_by_align(lay, order, n);
+		order[n] = n;
+		packed = layout_repack(lay, order, NULL);
+		phdr = packed->members[n].offset;
+		if (phdr <= cachelinesize)
+			printf("/* flex: packed by alignment, the header takes "
+			    "%ju bytes and fits one line */\n",
+			    (uintmax_t)phdr);
+		else
+			printf("/* flex: the header needs %ju fewer bytes to "
+			    "fit one line (%ju packed) */\n",
+			    (uintmax_t)(phdr - cachelinesize), (uintmax_t)phdr);
+		layout_free(packed);
+		free(order);
+	} else if (hdr > 0 && worst_lines(hdr, step) > 1)
+		printf("/* flex: the header fits one line only when line "
+		    "aligned, e.g. with aligned_alloc(%zu, ...) */\n",
+		    cachelinesize);
+	else if (hdr > 0)
+		printf("/* flex: the header fits one line at any malloc() "
+		    "base */\n");
+}
+
+/*
+ * "buffers": arrays of at least -B bytes (default 128) that push the
+ * members after them onto distant cachelines.  Lists the hot (annotated
+ * "hot") or scalar members placed after each buffer and how many lines
+ * they are displaced by, then estimates moving the buffer to the end of
+ * the struct and out of line behind a pointer.
+ */
+static void
+report_buffers(const struct layout *lay)
+{
+	const struct member *buf, *mem;
+	struct layout *nl, *copy;
+	const struct annot *an;
+	Dwarf_Word now, was, maxline;
+	unsigned *order, i, j, n, ndisp, maxdisp;
+	const char *sep;
+
+	if (lay->nevars > 0)
+		return;
+	order = xcalloc(MAX(lay->nmembers, 1), sizeof(*order));
+	for (i = 0; i < lay->nmembers; i++) {
+		buf = &lay->members[i];
+		if ((buf->flags & MEM_ARRAY) == 0 || buf->size < bigbuffer)
+			continue;
+
+		ndisp = maxdisp = 0;
+		sep = "";
+		for (j = i + 1; j < lay->nmembers; j++) {
+			mem = &lay->members[j];
+			an = annot_find(lay->name, mem->name);
+			if ((an == NULL || (an->flags & ANNOT_HOT) == 0) &&
+			    (mem->flags & (MEM_ARRAY | MEM_STRUCT)) != 0)
+				continue;
+			now = mem->offset / cachelinesize;
+			was = (mem->offset - buf->size) / cachelinesize;
+			if (now == was)
+				continue;
+			if (ndisp++ == 0)
+				printf("/* buffers: %s.%s (%s, %ju bytes) at %ju "
+				    "displaces ", lay->name, buf->name,
+				    buf->type_name, (uintmax_t)buf->size,
+				    (uintmax_t)buf->offset);
+			printf("%s%s (line %ju, was %ju)", sep, mem->name,
+			    (uintmax_t)now, (uintmax_t)was);
+			maxdisp = MAX(maxdisp, now - was);
+			sep = ", ";
+		}
+		if (ndisp == 0)
+			continue;
+		printf(" */\n");
+
+		/* The buffer last, the rest in their order. */
+		for (j = 0, n = 0; j < lay->nmembers; j++)
+			if (j != i)
+				order[n++] = j;
+		order[n] = i;
+		nl = layout_repack(lay, order, NULL);
+		maxline = 0;
+		for (j = 0; j < n; j++)
+			if (nl->members[j].size > 0)
+				maxline = MAX(maxline, (nl->members[j].offset +
+				    nl->members[j].size - 1) / cachelinesize);
+		printf("/* buffers: %s.%s: moved to the end, %+jd bytes, the "
+		    "other members fit in %ju cacheline%s (up to %u closer) "
+		    "*/\n", lay->name, buf->name,
+		    (intmax_t)nl->size - (intmax_t)lay->size,
+		    (uintmax_t)(maxline + 1), maxline == 0 ? "" : "s", maxdisp);
+		layout_free(nl);
+
+		/* Out of line: a pointer in its place. */
+		copy = layout_insert(lay, NULL, 0);
+		copy->members[i].size = pointer_size;
+		copy->members[i].align = pointer_size;
+		copy->members[i].flags = MEM_POINTER;
+		copy->align = MAX(copy->align, pointer_size);
+		for (j = 0; j < lay->nmembers; j++)
+			order[j] = j;
+		nl = layout_repack(copy, order, NULL);
+		printf("/* buffers: %s.%s: out of line behind a pointer, %ju "
+		    "-> %ju bytes, cachelines: %ju -> %ju, plus an allocation "
+		    "and a dependent load */\n", lay->name, buf->name,
+		    (uintmax_t)lay->size, (uintmax_t)nl->size,
+		    (uintmax_t)howmany(lay->size, cachelinesize),
+		    (uintmax_t)howmany(nl->size, cachelinesize));
+		layout_free(nl);
+		layout_free(copy);
+	}
+	free(order);
+}
+
+static struct report reports[] = {
+	{ "rw",		report_rw,	NULL,			false, false },
+	{ "owner",	report_owner,	NULL,			false, false },
+	{ "arrays",	report_arrays,	report_arrays_globals,	false, false },
+	{ "rodata",	NULL,		report_rodata_globals,	false, false },
+	{ "pages",	NULL,		report_pages_globals,	false, false },
+	{ "relocs",	NULL,		report_relocs_globals,	true,  false },
+	{ "order",	NULL,		report_order_globals,	false, false },
+	{ "nearmiss",	report_nearmiss, NULL,			false, false },
+	{ "insert",	report_insert,	NULL,			false, false },
+	{ "simd",	report_simd,	NULL,			false, false },
+	{ "splitlock",	report_splitlock, NULL,			false, false },
+	{ "heap",	report_heap,	NULL,			false, false },
+	{ "sets",	report_sets,	NULL,			false, false },
+	{ "flex",	report_flex,	NULL,			false, false },
+	{ "buffers",	report_buffers,	NULL,			false, false },
+};
+
+static void
+reports_enable(char *list)
+{
+	char *name;
+	size_t i;
+
+	while ((name = strsep(&list, ",")) != NULL) {
+		for (i = 0; i < nitems(reports); i++)
+			if (strcmp(reports[i].name, name) == 0)
+				break;
+		if (i == nitems(reports))
+			errx(EX_USAGE, "unknown report: %s", name);
+		reports[i].enabled = true;
+		if (reports[i].binfn != NULL)
+			wantvars = true;
+		if (reports[i].gvlayouts)
+			wantgvlayouts = true;
+	}
+}
+
+static bool
+report_enabled(void (*fn)(const struct layout *))
+{
+	size_t i;
+
+	for (i = 0; i < nitems(reports); i++)
+		if (reports[i].fn == fn)
+			return (reports[i].enabled);
+	return (false);
+}
+
+static void
+run_reports(const struct layout *lay)
+{
+	size_t i;
+
+	if (lay->nofields)
+		return;
+	for (i = 0; i < nitems(reports); i++)
+		if (reports[i].enabled && reports[i].fn != NULL)
+			reports[i].fn(lay);
+}
+
+static void
+run_binreports(void)
+{
+	size_t i;
+
+	for (i = 0; i < nitems(reports); i++)
+		if (reports[i].enabled && reports[i].binfn != NULL)
+			reports[i].binfn();
+}
+
+/*
+ * Schema export (-E).  Structs that are written to disk and mmap()ed back
+ * need a layout that reads the same everywhere: fixed-size scalars, no
+ * pointers, and no padding left to the compiler.  Nested structs are
+ * flattened into dotted field names.  "schema" prints a stable, versioned
+ * text descriptor; "c" prints a header of memcpy()-based accessors that
+ * convert from the producer's byte order, plus static assertions against the
+ * struct definition.
+ */
+#define	SCHEMA_VERSION	1
+
+struct field {
+	char		 name[256];
+	Dwarf_Word	 offset;
+	Dwarf_Word	 size;		/* Of one element */
+	Dwarf_Word	 count;		/* 1 unless an array */
+	const char	*kind;		/* "int32", "float64", ... */
+};
+
+static const char *
+scalar_kind(int encoding, Dwarf_Word size)
+{
+	static const char *const sints[] = { "int8", "int16", "int32",
+	    "int64" };
+	static const char *const uints[] = { "uint8", "uint16", "uint32",
+	    "uint64" };
+	int lg;
+
+	switch (size) {
+	case 1: lg = 0; break;
+	case 2: lg = 1; break;
+	case 4: lg = 2; break;
+	case 8: lg = 3; break;
+	default: return (NULL);
+	}
+
+	switch (encoding) {
+	case DW_ATE_signed:
+	case DW_ATE_signed_char:
+		return (sints[lg]);
+	case DW_ATE_unsigned:
+	case DW_ATE_unsigned_char:
+	case DW_ATE_UTF:
+		return (uints[lg]);
+	case DW_ATE_boolean:
+		return (size == 1 ? "bool8" : NULL);
+	case DW_ATE_float:
+		if (size == 4)
+			return ("float32");
+		if (size == 8)
+			return ("float64");
+		return (NULL);
+	default:
+		return (NULL);
+	}
+}
+
+/*
+ * Append the fields of 'lay', placed at 'base' with names under 'prefix', to
+ * 'fields'.  On failure, 'why' says what makes the layout unexportable.
+ */
+static bool
+schema_flatten(const struct layout *lay, const char *prefix, Dwarf_Word base,
+    struct field **fieldsp, size_t *nfieldsp, size_t *capp, char *why,
+    size_t whylen)
+{
+	const struct member *mem;
+	struct field *f;
+	Dwarf_Word end, size;
+	char name[256];
+	unsigned i;
+
+	end = 0;
+	for (i = 0; i < lay->nmembers; i++) {
+		mem = &lay->members[i];
+		snprintf(name, sizeof(name), "%s%s", prefix, mem->name);
+
+		if ((mem->flags & MEM_BITFIELD) != 0) {
+			snprintf(why, whylen, "'%s' is a bitfield", name);
+			return (false);
+		}
+		if (mem->offset != end) {
+			snprintf(why, whylen, "%ju bytes of %s before '%s'",
+			    (uintmax_t)(mem->offset > end ? mem->offset - end :
+			    end - mem->offset), mem->offset > end ?
+			    "compiler padding" : "overlap", name);
+			return (false);
+		}
+		end = mem->offset + mem->size;
+
+		if ((mem->flags & MEM_POINTER) != 0) {
+			snprintf(why, whylen, "'%s' is a pointer", name);
+			return (false);
+		}
+		if ((mem->flags & MEM_FLEX) != 0) {
+			snprintf(why, whylen, "'%s' has no fixed size", name);
+			return (false);
+		}
+		if ((mem->flags & (MEM_UNION | MEM_AGGR)) != 0) {
+			snprintf(why, whylen, "'%s' is a union or an array of "
+			    "structs", name);
+			return (false);
+		}
+		if ((mem->flags & MEM_STRUCT) != 0) {
+			if (mem->sub == NULL) {
+				snprintf(why, whylen, "'%s' is an empty or "
+				    "incomplete struct", name);
+				return (false);
+			}
+			if (strlen(name) + 2 > sizeof(name)) {
+				snprintf(why, whylen, "'%s' nests too deep",
+				    name);
+				return (false);
+			}
+			strcat(name, ".");
+			if (!schema_flatten(mem->sub, name, base + mem->offset,
+			    fieldsp, nfieldsp, capp, why, whylen))
+				return (false);
+			continue;
+		}
+
+		if (*nfieldsp == *capp) {
+			*capp = *capp ? *capp * 2 : 16;
+			*fieldsp = xreallocarray(*fieldsp, *capp,
+			    sizeof(**fieldsp));
+		}
+		f = &(*fieldsp)[(*nfieldsp)++];
+		memset(f, 0, sizeof(*f));
+		strcpy(f->name, name);
+		f->offset = base + mem->offset;
+		f->count = (mem->flags & MEM_ARRAY) != 0 ? mem->nelems : 1;
+		size = (mem->flags & MEM_ARRAY) != 0 ? mem->elemsize :
+		    mem->size;
+		f->size = size;
+		f->kind = scalar_kind(mem->encoding, size);
+		if (f->kind == NULL || f->count == 0) {
+			snprintf(why, whylen, "'%s' (%s) has no portable "
+			    "fixed-size encoding", name, mem->type_name);
+			return (false);
+		}
+	}
+	if (end != lay->size) {
+		snprintf(why, whylen, "%ju bytes of tail padding",
+		    (uintmax_t)(lay->size - end));
+		return (false);
+	}
+	return (true);
+}
+
+/* 'a.b[2]' -> 'a_b_2_', upper-cased if asked to. */
+static void
+c_ident(const char *in, char *out, size_t len, bool upper)
+{
+	size_t i;
+
+	for (i = 0; in[i] != '\0' && i + 1 < len; i++) {
+		if (isalnum((unsigned char)in[i]))
+			out[i] = upper ? toupper((unsigned char)in[i]) : in[i];
+		else
+			out[i] = '_';
+	}
+	out[i] = '\0';
+}
+
+static const char *
+c_scalar_type(const char *kind)
+{
+
+	if (strcmp(kind, "float32") == 0)
+		return ("float");
+	if (strcmp(kind, "float64") == 0)
+		return ("double");
+	if (strcmp(kind, "bool8") == 0)
+		return ("uint8_t");
+	return (NULL);
+}
+
+static void
+export_c(const struct layout *lay, const struct field *fields, size_t n,
+    const char *binary)
+{
+	const struct field *f;
+	char id[256], uid[256], fid[256], ufid[256], ctype[32];
+	const char *ct;
+	size_t i;
+
+	c_ident(lay->name, id, sizeof(id), false);
+	c_ident(lay->name, uid, sizeof(uid), true);
+
+	printf("/*\n"
+	    " * Zero-copy accessors for struct %s, generated by structhole from\n"
+	    " * %s.  Do not edit.\n"
+	    " */\n\n", lay->name, binary);
+	printf("#ifndef %s_SCHEMA_H\n#define %s_SCHEMA_H\n\n", uid, uid);
+	printf("#include <stddef.h>\n#include <stdint.h>\n#include <string.h>\n\n");
+	printf("#define\t%s_SCHEMA_VERSION\t%d\n", uid, SCHEMA_VERSION);
+	printf("#define\t%s_SCHEMA_HASH\t0x%016jxULL\n", uid,
+	    (uintmax_t)lay->hash);
+	printf("#define\t%s_SCHEMA_SIZE\t%ju\n\n", uid, (uintmax_t)lay->size);
+
+	printf("#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) != %d\n",
+	    lay->bigendian ? 1 : 0);
+	printf("#define\t%s_SWAP16(x)\t__builtin_bswap16(x)\n", uid);
+	printf("#define\t%s_SWAP32(x)\t__builtin_bswap32(x)\n", uid);
+	printf("#define\t%s_SWAP64(x)\t__builtin_bswap64(x)\n", uid);
+	printf("#else\n");
+	printf("#define\t%s_SWAP16(x)\t(x)\n", uid);
+	printf("#define\t%s_SWAP32(x)\t(x)\n", uid);
+	printf("#define\t%s_SWAP64(x)\t(x)\n", uid);
+	printf("#endif\n\n");
+
+	printf("static inline int\n%s_schema_fits(size_t len)\n{\n\n"
+	    "\treturn (len >= %s_SCHEMA_SIZE);\n}\n", id, uid);
+
+	for (i = 0; i < n; i++) {
+		f = &fields[i];
+		c_ident(f->name, fid, sizeof(fid), false);
+		c_ident(f->name, ufid, sizeof(ufid), true);
+		if ((ct = c_scalar_type(f->kind)) == NULL) {
+			snprintf(ctype, sizeof(ctype), "%s_t", f->kind);
+			ct = ctype;
+		}
+
+		printf("\n");
+		if (f->count > 1)
+			printf("#define\t%s_%s_COUNT\t%ju\n\n", uid, ufid,
+			    (uintmax_t)f->count);
+		printf("static inline %s\n%s_get_%s(const void *p%s)\n{\n", ct,
+		    id, fid, f->count > 1 ? ", size_t i" : "");
+		printf("\tuint%ju_t u;\n\t%s v;\n\n", (uintmax_t)f->size * 8,
+		    ct);
+		printf("\tmemcpy(&u, (const unsigned char *)p + %ju%s, "
+		    "sizeof(u));\n", (uintmax_t)f->offset,
+		    f->count > 1 ? (f->size == 1 ? " + i" :
+		    f->size == 2 ? " + i * 2" : f->size == 4 ? " + i * 4" :
+		    " + i * 8") : "");
+		if (f->size > 1)
+			printf("\tu = %s_SWAP%ju(u);\n", uid,
+			    (uintmax_t)f->size * 8);
+		printf("\tmemcpy(&v, &u, sizeof(v));\n\treturn (v);\n}\n");
+	}
+
+	/* Check a consumer's copy of the definition against the producer. */
+	printf("\n#ifdef %s_SCHEMA_CHECK\n", uid);
+	printf("_Static_assert(sizeof(struct %s) == %ju, \"size\");\n",
+	    lay->name, (uintmax_t)lay->size);
+	for (i = 0; i < n; i++)
+		printf("_Static_assert(offsetof(struct %s, %s) == %ju, "
+		    "\"%s\");\n", lay->name, fields[i].name,
+		    (uintmax_t)fields[i].offset, fields[i].name);
+	printf("#endif\n\n#endif /* !%s_SCHEMA_H */\n", uid);
+}
+
+static void
+export_layout(const struct layout *lay, const char *binary)
+{
+	struct field *fields;
+	size_t i, n, cap;
+	char why[512];
+
+	if (lay->nofields) {
+		warnx("struct %s: cannot export: no data members in dump",
+		    lay->name);
+		export_failed = true;
+		return;
+	}
+
+	fields = NULL;
+	n = cap = 0;
+	if (!schema_flatten(lay, "", 0, &fields, &n, &cap, why, sizeof(why))) {
+		warnx("struct %s: cannot export: %s", lay->name, why);
+		export_failed = true;
+		free(fields);
+		return;
+	}
+
+	if (strcmp(exportfmt, "c") == 0) {
+		export_c(lay, fields, n, binary);
+		free(fields);
+		return;
+	}
+
+	printf("structhole-schema %d\n", SCHEMA_VERSION);
+	printf("struct %s\n", lay->name);
+	printf("hash %016jx\n", (uintmax_t)lay->hash);
+	printf("size %ju\n", (uintmax_t)lay->size);
+	printf("align %u\n", lay->align);
+	printf("endian %s\n", lay->bigendian ? "big" : "little");
+	for (i = 0; i < n; i++)
+		printf("field %s %ju %s %ju\n", fields[i].name,
+		    (uintmax_t)fields[i].offset, fields[i].kind,
+		    (uintmax_t)fields[i].count);
+	printf("end\n");
+	free(fields);
+}
+
+/*
+ * -E btf: the types reachable from the matched structs, encoded as BTF (the
+ * compact type format of the Linux kernel and libbpf) in the binary's byte
+ * order, and written where btf_path() says.  Definitions of a struct
+ * repeated across CUs are merged by name, size and the encoded types of
+ * their members (btf_struct()); every other type by its exact encoding.
+ */
+enum {
+	BTF_KIND_INT = 1,
+	BTF_KIND_PTR = 2,
+	BTF_KIND_ARRAY = 3,
+	BTF_KIND_STRUCT = 4,
+	BTF_KIND_UNION = 5,
+	BTF_KIND_ENUM = 6,
+	BTF_KIND_FWD = 7,
+	BTF_KIND_TYPEDEF = 8,
+	BTF_KIND_VOLATILE = 9,
+	BTF_KIND_CONST = 10,
+	BTF_KIND_RESTRICT = 11,
+	BTF_KIND_FUNC_PROTO = 13,
+	BTF_KIND_FLOAT = 16,
+	BTF_KIND_ENUM64 = 19,
+};
+#define	BTF_MAGIC	0xeb9f
+#define	BTF_HDR_LEN	24
+#define	BTF_MAX_VLEN	0xffff
+#define	BTF_INT_SIGNED	0x1
+#define	BTF_INT_BOOL	0x4
+
+struct btfbuf {
+	unsigned char	*v;
+	size_t		 n, cap;
+};
+
+struct btftype {
+	struct btfbuf	 rec;		/* btf_type and its trailing data */
+	struct btfbuf	 key;		/* Structs: name, size and members */
+	uint64_t	 hash;
+};
+
+struct btfdie {
+	Dwarf_Off	 off;
+	uint32_t	 id;
+};
+
+/*
+ * Both hash tables log their insertions, so that encoding a struct which
+ * turns out to be a duplicate can be undone by removing the newest entries
+ * in reverse order.  Rehashing replays the log to keep that order.
+ */
+static struct btftype *btftypes;	/* Type id i is btftypes[i - 1] */
+static size_t nbtftypes, btftypescap;
+static uint32_t *btftypehash;		/* Type ids, by key hash */
+static size_t btftypehashsz;
+static uint32_t *btftypelog;
+static size_t nbtftypelog, btftypelogcap;
+static struct btfbuf btfstrs;
+static uint32_t *btfstrhash;		/* String offsets, by hash */
+static size_t btfstrhashsz, nbtfstrs;
+static struct btfdie *btfdies;		/* Type ids, by DIE offset */
+static size_t btfdiessz;
+static Dwarf_Off *btfdielog;
+static size_t nbtfdielog, btfdielogcap;
+
+static void
+btfbuf_put(struct btfbuf *b, const void *p, size_t len)
+{
+
+	if (len == 0)
+		return;
+	if (b->n + len > b->cap) {
+		b->cap = b->cap ? b->cap * 2 : 64;
+		if (b->cap < b->n + len)
+			b->cap = b->n + len;
+		b->v = xreallocarray(b->v, b->cap, 1);
+	}
+	memcpy(b->v + b->n, p, len);
+	b->n += len;
+}
+
+/* A 'len'-byte integer in the binary's byte order. */
+static void
+btfbuf_int(struct btfbuf *b, uint32_t w, unsigned len)
+{
+	unsigned char p[4];
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		p[i] = w >> (8 * (bigendian ? len - 1 - i : i));
+	btfbuf_put(b, p, len);
+}
+
+static void
+btfbuf_u32(struct btfbuf *b, uint32_t w)
+{
+
+	btfbuf_int(b, w, 4);
+}
+
+static uint32_t
+btf_str(const char *s)
+{
+	uint32_t *old, off;
+	size_t i, slot, oldsz, len;
+
+	if (s == NULL || *s == '\0')
+		return (0);
+	if (btfstrs.n == 0)
+		btfbuf_put(&btfstrs, "", 1);
+
+	if (2 * (nbtfstrs + 1) > btfstrhashsz) {
+		old = btfstrhash;
+		oldsz = btfstrhashsz;
+		btfstrhashsz = oldsz ? oldsz * 2 : 1024;
+		btfstrhash = xcalloc(btfstrhashsz, sizeof(*btfstrhash));
+		for (i = 0; i < oldsz; i++) {
+			if (old[i] == 0)
+				continue;
+			off = old[i];
+			len = strlen((char *)btfstrs.v + off);
+			slot = fnv1a(0xcbf29ce484222325ull, btfstrs.v + off,
+			    len) & (btfstrhashsz - 1);
+			while (btfstrhash[slot] != 0)
+				slot = (slot + 1) & (btfstrhashsz - 1);
+			btfstrhash[slot] = off;
+		}
+		free(old);
+	}
+
+	len = strlen(s);
+	slot = fnv1a(0xcbf29ce484222325ull, s, len) & (btfstrhashsz - 1);
+	for (; btfstrhash[slot] != 0; slot = (slot + 1) & (btfstrhashsz - 1))
+		if (strcmp((char *)btfstrs.v + btfstrhash[slot], s) == 0)
+			return (btfstrhash[slot]);
+
+	off = btfstrs.n;
+	btfbuf_put(&btfstrs, s, len + 1);
+	btfstrhash[slot] = off;
+	nbtfstrs++;
+	return (off);
+}
+
+/* Struct keys are compared with struct keys, encodings with encodings. */
+static const struct btfbuf *
+btf_key(const struct btftype *t)
+{
+
+	return (t->key.n != 0 ? &t->key : &t->rec);
+}
+
+static uint32_t
+btf_lookup(const struct btfbuf *key, bool iskey, uint64_t h)
+{
+	const struct btftype *t;
+	size_t slot;
+
+	if (btftypehashsz == 0)
+		return (0);
+	slot = h & (btftypehashsz - 1);
+	for (; btftypehash[slot] != 0; slot = (slot + 1) &
+	    (btftypehashsz - 1)) {
+		t = &btftypes[btftypehash[slot] - 1];
+		if (t->hash == h && (t->key.n != 0) == iskey &&
+		    btf_key(t)->n == key->n &&
+		    memcmp(btf_key(t)->v, key->v, key->n) == 0)
+			return (btftypehash[slot]);
+	}
+	return (0);
+}
+
+static size_t
+btf_hash_slot(uint32_t id)
+{
+	size_t slot;
+
+	slot = btftypes[id - 1].hash & (btftypehashsz - 1);
+	while (btftypehash[slot] != 0 && btftypehash[slot] != id)
+		slot = (slot + 1) & (btftypehashsz - 1);
+	return (slot);
+}
+
+/* Make type 'id' findable by its key or encoding. */
+static void
+btf_hash_insert(uint32_t id)
+{
+	size_t i;
+
+	if (2 * (nbtftypelog + 1) > btftypehashsz) {
+		free(btftypehash);
+		btftypehashsz = btftypehashsz ? btftypehashsz * 2 : 1024;
+		btftypehash = xcalloc(btftypehashsz, sizeof(*btftypehash));
+		for (i = 0; i < nbtftypelog; i++)
+			btftypehash[btf_hash_slot(btftypelog[i])] =
+			    btftypelog[i];
+	}
+	if (nbtftypelog == btftypelogcap) {
+		btftypelogcap = btftypelogcap ? btftypelogcap * 2 : 256;
+		btftypelog = xreallocarray(btftypelog, btftypelogcap,
+		    sizeof(*btftypelog));
+	}
+	btftypelog[nbtftypelog++] = id;
+	btftypehash[btf_hash_slot(id)] = id;
+}
+
+/* A new type id; 'rec' and 'key' are taken over. */
+static uint32_t
+btf_new(struct btfbuf *rec, struct btfbuf *key, uint64_t h)
+{
+	struct btftype *t;
+
+	if (nbtftypes == btftypescap) {
+		btftypescap = btftypescap ? btftypescap * 2 : 256;
+		btftypes = xreallocarray(btftypes, btftypescap,
+		    sizeof(*btftypes));
+	}
+	t = &btftypes[nbtftypes++];
+	memset(t, 0, sizeof(*t));
+	if (rec != NULL)
+		t->rec = *rec;
+	if (key != NULL)
+		t->key = *key;
+	t->hash = h;
+	return (nbtftypes);
+}
+
+/* Add an encoded type, or find an identical one. */
+static uint32_t
+btf_add(struct btfbuf *rec)
+{
+	uint64_t h;
+	uint32_t id;
+
+	h = fnv1a(0xcbf29ce484222325ull, rec->v, rec->n);
+	if ((id = btf_lookup(rec, false, h)) != 0) {
+		free(rec->v);
+		return (id);
+	}
+	id = btf_new(rec, NULL, h);
+	btf_hash_insert(id);
+	return (id);
+}
+
+static size_t
+btf_die_slot(const struct btfdie *dies, size_t sz, Dwarf_Off off)
+{
+	size_t slot;
+
+	slot = (off * 0x9e3779b97f4a7c15ull >> 32) & (sz - 1);
+	while (dies[slot].off != 0 && dies[slot].off != off)
+		slot = (slot + 1) & (sz - 1);
+	return (slot);
+}
+
+static uint32_t
+btf_die_lookup(Dwarf_Off off)
+{
+
+	if (btfdiessz == 0)
+		return (0);
+	return (btfdies[btf_die_slot(btfdies, btfdiessz, off)].id);
+}
+
+static void
+btf_die_set(Dwarf_Off off, uint32_t id)
+{
+	struct btfdie *old;
+	size_t i, slot, oldsz;
+
+	if (2 * (nbtfdielog + 1) > btfdiessz) {
+		old = btfdies;
+		oldsz = btfdiessz;
+		btfdiessz = oldsz ? oldsz * 2 : 1024;
+		btfdies = xcalloc(btfdiessz, sizeof(*btfdies));
+		for (i = 0; i < nbtfdielog; i++) {
+			slot = btf_die_slot(btfdies, btfdiessz, btfdielog[i]);
+			btfdies[slot] = old[btf_die_slot(old, oldsz,
+			    btfdielog[i])];
+		}
+		free(old);
+	}
+
+	slot = btf_die_slot(btfdies, btfdiessz, off);
+	if (btfdies[slot].off == 0) {
+		if (nbtfdielog == btfdielogcap) {
+			btfdielogcap = btfdielogcap ? btfdielogcap * 2 : 256;
+			btfdielog = xreallocarray(btfdielog, btfdielogcap,
+			    sizeof(*btfdielog));
+		}
+		btfdielog[nbtfdielog++] = off;
+	}
+	btfdies[slot].off = off;
+	btfdies[slot].id = id;
+}
+
+/*
+ * Forget types from 'id' on and the table entries made since 'types' and
+ * 'dies'; DIEs found to be types older than 'id' stay known.
+ */
+static void
+btf_rollback(uint32_t id, size_t types, size_t dies)
+{
+	struct btfdie *keep;
+	size_t i, n, slot;
+
+	while (nbtftypelog > types)
+		btftypehash[btf_hash_slot(btftypelog[--nbtftypelog])] = 0;
+
+	keep = xcalloc(MAX(nbtfdielog - dies, 1), sizeof(*keep));
+	n = 0;
+	while (nbtfdielog > dies) {
+		slot = btf_die_slot(btfdies, btfdiessz,
+		    btfdielog[--nbtfdielog]);
+		if (btfdies[slot].id < id)
+			keep[n++] = btfdies[slot];
+		btfdies[slot].off = 0;
+		btfdies[slot].id = 0;
+	}
+	for (i = n; i-- > 0;)
+		btf_die_set(keep[i].off, keep[i].id);
+	free(keep);
+
+	while (nbtftypes >= id) {
+		nbtftypes--;
+		free(btftypes[nbtftypes].rec.v);
+		free(btftypes[nbtftypes].key.v);
+	}
+}
+
+static void
+btf_hdr(struct btfbuf *b, const char *name, unsigned kind, size_t vlen,
+    bool kflag, uint32_t sizetype)
+{
+
+	btfbuf_u32(b, btf_str(name));
+	btfbuf_u32(b, (kflag ? 1u << 31 : 0) | kind << 24 | (uint32_t)vlen);
+	btfbuf_u32(b, sizetype);
+}
+
+static uint32_t
+btf_int(const char *name, unsigned size, unsigned enc)
+{
+	struct btfbuf b = { 0 };
+
+	btf_hdr(&b, name, BTF_KIND_INT, 0, false, size);
+	btfbuf_u32(&b, enc << 24 | size * 8);
+	return (btf_add(&b));
+}
+
+static uint32_t
+btf_array_of(uint32_t elem, Dwarf_Word nelems)
+{
+	struct btfbuf b = { 0 };
+
+	btf_hdr(&b, NULL, BTF_KIND_ARRAY, 0, false, 0);
+	btfbuf_u32(&b, elem);
+	btfbuf_u32(&b, btf_int("__ARRAY_SIZE_TYPE__", 4, 0));
+	btfbuf_u32(&b, nelems);
+	return (btf_add(&b));
+}
+
+static uint32_t btf_type(Dwarf_Die *);
+
+/* The type 'die' refers to; void if none. */
+static uint32_t
+btf_ref(Dwarf_Die *die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die target;
+
+	if (dwarf_attr_integrate(die, DW_AT_type, &attr) == NULL ||
+	    dwarf_formref_die(&attr, &target) == NULL)
+		return (0);
+	return (btf_type(&target));
+}
+
+static uint32_t
+btf_base(Dwarf_Die *die)
+{
+	Dwarf_Attribute attr;
+	struct btfbuf b = { 0 };
+	Dwarf_Word enc;
+	int size;
+
+	if ((size = dwarf_bytesize(die)) <= 0)
+		return (0);
+	if (dwarf_attr_integrate(die, DW_AT_encoding, &attr) == NULL ||
+	    dwarf_formudata(&attr, &enc) != 0)
+		enc = DW_ATE_unsigned;
+
+	switch (enc) {
+	case DW_ATE_float:
+		if (size == 2 || size == 4 || size == 8 || size == 12 ||
+		    size == 16) {
+			btf_hdr(&b, dwarf_diename(die), BTF_KIND_FLOAT, 0,
+			    false, size);
+			return (btf_add(&b));
+		}
+		break;
+	case DW_ATE_boolean:
+		if (size <= 16)
+			return (btf_int(dwarf_diename(die), size,
+			    BTF_INT_BOOL));
+		break;
+	case DW_ATE_signed:
+	case DW_ATE_signed_char:
+		if (size <= 16)
+			return (btf_int(dwarf_diename(die), size,
+			    BTF_INT_SIGNED));
+		break;
+	case DW_ATE_unsigned:
+	case DW_ATE_unsigned_char:
+	case DW_ATE_UTF:
+		if (size <= 16)
+			return (btf_int(dwarf_diename(die), size, 0));
+		break;
+	}
+
+	/* Complex and other types BTF lacks: a named run of bytes. */
+	btf_hdr(&b, dwarf_diename(die), BTF_KIND_TYPEDEF, 0, false,
+	    btf_array_of(btf_int("unsigned char", 1, 0), size));
+	return (btf_add(&b));
+}
+
+static uint32_t
+btf_array(Dwarf_Die *die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die sub;
+	Dwarf_Word dims[16], n, lower, upper;
+	uint32_t id;
+	size_t ndims;
+
+	id = btf_ref(die);
+	ndims = 0;
+	if (dwarf_child(die, &sub) == 0) {
+		do {
+			if (dwarf_tag(&sub) != DW_TAG_subrange_type ||
+			    ndims == nitems(dims))
+				continue;
+			lower = 0;
+			if (dwarf_attr_integrate(&sub, DW_AT_lower_bound,
+			    &attr) != NULL && dwarf_formudata(&attr, &lower))
+				lower = 0;
+			if (dwarf_attr_integrate(&sub, DW_AT_count, &attr) !=
+			    NULL && dwarf_formudata(&attr, &n) == 0)
+				;
+			else if (dwarf_attr_integrate(&sub, DW_AT_upper_bound,
+			    &attr) != NULL && dwarf_formudata(&attr, &upper) ==
+			    0)
+				n = upper + 1 - lower;
+			else
+				n = 0;
+			dims[ndims++] = n;
+		} while (dwarf_siblingof(&sub, &sub) == 0);
+	}
+	if (ndims == 0)
+		dims[ndims++] = 0;
+
+	while (ndims-- > 0)
+		id = btf_array_of(id, dims[ndims]);
+	return (id);
+}
+
+/*
+ * Bitfield member type for structs without kind_flag: an INT of the
+ * storage unit's size carrying the width, as BTF had before kind_flag.
+ */
+static uint32_t
+btf_bitfield(Dwarf_Die *type, unsigned bits)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die peeled;
+	struct btfbuf b = { 0 };
+	Dwarf_Word enc;
+	unsigned flags;
+	int size;
+
+	if (dwarf_peel_type(type, &peeled) != 0)
+		peeled = *type;
+	if ((size = dwarf_bytesize(&peeled)) <= 0)
+		size = 4;
+	flags = 0;
+	if (dwarf_tag(&peeled) == DW_TAG_base_type &&
+	    dwarf_attr_integrate(&peeled, DW_AT_encoding, &attr) != NULL &&
+	    dwarf_formudata(&attr, &enc) == 0) {
+		if (enc == DW_ATE_signed || enc == DW_ATE_signed_char)
+			flags = BTF_INT_SIGNED;
+		else if (enc == DW_ATE_boolean)
+			flags = BTF_INT_BOOL;
+	}
+	btf_hdr(&b, dwarf_diename(&peeled), BTF_KIND_INT, 0, false, size);
+	btfbuf_u32(&b, flags << 24 | bits);
+	return (btf_add(&b));
+}
+
+/*
+ * Whether a member of type 'die' reaches a struct or union through a
+ * pointer, possibly one still being encoded.
+ */
+static bool
+btf_viaptr(Dwarf_Die *die, bool ptr)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die target, child;
+
+	switch (dwarf_tag(die)) {
+	case DW_TAG_structure_type:
+	case DW_TAG_class_type:
+	case DW_TAG_union_type:
+		return (ptr);
+	case DW_TAG_pointer_type:
+	case DW_TAG_reference_type:
+	case DW_TAG_rvalue_reference_type:
+		ptr = true;
+		break;
+	case DW_TAG_subroutine_type:
+		if (dwarf_child(die, &child) == 0) {
+			do {
+				if (dwarf_tag(&child) ==
+				    DW_TAG_formal_parameter &&
+				    dwarf_attr_integrate(&child, DW_AT_type,
+				    &attr) != NULL &&
+				    dwarf_formref_die(&attr, &target) != NULL &&
+				    btf_viaptr(&target, ptr))
+					return (true);
+			} while (dwarf_siblingof(&child, &child) == 0);
+		}
+		break;
+	}
+	if (dwarf_attr_integrate(die, DW_AT_type, &attr) == NULL ||
+	    dwarf_formref_die(&attr, &target) == NULL)
+		return (false);
+	return (btf_viaptr(&target, ptr));
+}
+
+/*
+ * A struct gets its id before its members are encoded, so that pointers
+ * back to it (lists, trees) terminate.  Its key is then its name, size and,
+ * per member, name, placement and encoded type.  Pointers to structs are
+ * keyed by type name instead: they are how cycles close, and the encoding
+ * of one inside a cycle names the provisional id.  A struct matching an
+ * earlier one is undone, along with every type encoded for it.
+ */
+static uint32_t
+btf_struct(Dwarf_Die *die)
+{
+	struct btfmem {
+		const char	*name;
+		Dwarf_Die	 type;
+		Dwarf_Word	 bitoff;
+		unsigned	 bitsize;
+	} *mems;
+	Dwarf_Attribute attr;
+	Dwarf_Die child, storage;
+	struct btfbuf b = { 0 }, key = { 0 }, body = { 0 };
+	Dwarf_Word off, w;
+	uint64_t h;
+	uint32_t id, dup, kind, size, tid;
+	size_t i, n, cap, types, dies;
+	const char *name;
+	char type_name[128];
+	bool bitfields, kflag;
+	int x, bo, unit;
+
+	name = dwarf_diename(die);
+	kind = dwarf_tag(die) == DW_TAG_union_type ? BTF_KIND_UNION :
+	    BTF_KIND_STRUCT;
+	if (dwarf_hasattr(die, DW_AT_declaration) || dwarf_bytesize(die) < 0) {
+		btf_hdr(&b, name, BTF_KIND_FWD, 0, kind == BTF_KIND_UNION, 0);
+		return (btf_add(&b));
+	}
+	size = dwarf_bytesize(die);
+
+	mems = NULL;
+	n = cap = 0;
+	bitfields = false;
+	kflag = true;
+	if (dwarf_child(die, &child) == 0) {
+		do {
+			if ((dwarf_tag(&child) != DW_TAG_member &&
+			    dwarf_tag(&child) != DW_TAG_inheritance) ||
+			    dwarf_hasattr(&child, DW_AT_external) ||
+			    dwarf_hasattr(&child, DW_AT_declaration) ||
+			    n == BTF_MAX_VLEN)
+				continue;
+			if (n == cap) {
+				cap = cap ? cap * 2 : 16;
+				mems = xreallocarray(mems, cap, sizeof(*mems));
+			}
+			mems[n].name = dwarf_diename(&child);
+			get_dwarf_attr(&child, DW_AT_type, &attr, &mems[n].type);
+			x = dwarf_bitsize(&child);
+			mems[n].bitsize = x > 0 ? x : 0;
+			if (dwarf_attr_integrate(&child, DW_AT_data_bit_offset,
+			    &attr) != NULL && dwarf_formudata(&attr, &w) == 0) {
+				mems[n].bitoff = w;
+				goto placed;
+			}
+			if (get_member_offset(&child, &off) != 0)
+				off = 0;
+			mems[n].bitoff = off * 8;
+			if (x > 0 && (bo = dwarf_bitoffset(&child)) >= 0) {
+				/* DWARF 2/3: counted from the unit's MSB. */
+				unit = dwarf_bytesize(&child);
+				if (unit <= 0 && dwarf_peel_type(&mems[n].type,
+				    &storage) == 0)
+					unit = dwarf_bytesize(&storage);
+				if (bigendian)
+					mems[n].bitoff += bo;
+				else if (unit * 8 >= bo + x)
+					mems[n].bitoff += unit * 8 - bo - x;
+			}
+placed:
+			if (mems[n].bitsize != 0)
+				bitfields = true;
+			/* kind_flag offsets have 24 bits, widths 8. */
+			if (mems[n].bitoff >= 1u << 24 ||
+			    mems[n].bitsize > 0xff)
+				kflag = false;
+			n++;
+		} while (dwarf_siblingof(&child, &child) == 0);
+	}
+	kflag = bitfields && kflag;
+
+	types = nbtftypelog;
+	dies = nbtfdielog;
+	id = btf_new(NULL, NULL, 0);
+	btf_die_set(dwarf_dieoffset(die), id);
+
+	btfbuf_put(&key, &kind, sizeof(kind));
+	btfbuf_put(&key, name != NULL ? name : "", name != NULL ?
+	    strlen(name) + 1 : 1);
+	btfbuf_put(&key, &size, sizeof(size));
+	for (i = 0; i < n; i++) {
+		if (mems[i].bitsize != 0 && !kflag)
+			tid = btf_bitfield(&mems[i].type, mems[i].bitsize);
+		else
+			tid = btf_type(&mems[i].type);
+
+		btfbuf_u32(&body, btf_str(mems[i].name));
+		btfbuf_u32(&body, tid);
+		btfbuf_u32(&body, kflag ? mems[i].bitsize << 24 |
+		    (uint32_t)mems[i].bitoff : (uint32_t)mems[i].bitoff);
+
+		btfbuf_put(&key, mems[i].name != NULL ? mems[i].name : "",
+		    mems[i].name != NULL ? strlen(mems[i].name) + 1 : 1);
+		btfbuf_put(&key, &mems[i].bitoff, sizeof(mems[i].bitoff));
+		btfbuf_put(&key, &mems[i].bitsize, sizeof(mems[i].bitsize));
+		if (!btf_viaptr(&mems[i].type, false)) {
+			btfbuf_put(&key, "i", 1);
+			btfbuf_put(&key, &tid, sizeof(tid));
+		} else {
+			type_name[0] = '\0';
+			(void)format_type_name(&mems[i].type, type_name,
+			    sizeof(type_name));
+			btfbuf_put(&key, "n", 1);
+			btfbuf_put(&key, type_name, strlen(type_name) + 1);
+		}
+	}
+	free(mems);
+
+	h = fnv1a(0xcbf29ce484222325ull, key.v, key.n);
+	if ((dup = btf_lookup(&key, true, h)) != 0) {
+		free(key.v);
+		free(body.v);
+		btf_rollback(id, types, dies);
+		btf_die_set(dwarf_dieoffset(die), dup);
+		return (dup);
+	}
+
+	btf_hdr(&b, name, kind, n, kflag, size);
+	btfbuf_put(&b, body.v, body.n);
+	free(body.v);
+	btftypes[id - 1].rec = b;
+	btftypes[id - 1].key = key;
+	btftypes[id - 1].hash = h;
+	btf_hash_insert(id);
+	return (id);
+}
+
+static uint32_t
+btf_enum(Dwarf_Die *die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die child;
+	struct btfbuf b = { 0 }, body = { 0 };
+	Dwarf_Sword sv;
+	Dwarf_Word uv;
+	size_t n;
+	int size;
+	bool sign;
+
+	if ((size = dwarf_bytesize(die)) <= 0)
+		size = 4;
+	n = 0;
+	sign = false;
+	if (dwarf_child(die, &child) == 0) {
+		do {
+			if (dwarf_tag(&child) != DW_TAG_enumerator ||
+			    n == BTF_MAX_VLEN ||
+			    dwarf_attr_integrate(&child, DW_AT_const_value,
+			    &attr) == NULL)
+				continue;
+			if (dwarf_whatform(&attr) == DW_FORM_sdata) {
+				if (dwarf_formsdata(&attr, &sv) != 0)
+					continue;
+				uv = sv;
+				if (sv < 0)
+					sign = true;
+			} else if (dwarf_formudata(&attr, &uv) != 0)
+				continue;
+			btfbuf_u32(&body, btf_str(dwarf_diename(&child)));
+			btfbuf_u32(&body, (uint32_t)uv);
+			if (size > 4)
+				btfbuf_u32(&body, (uint32_t)(uv >> 32));
+			n++;
+		} while (dwarf_siblingof(&child, &child) == 0);
+	}
+
+	btf_hdr(&b, dwarf_diename(die), size > 4 ? BTF_KIND_ENUM64 :
+	    BTF_KIND_ENUM, n, sign, size);
+	btfbuf_put(&b, body.v, body.n);
+	free(body.v);
+	return (btf_add(&b));
+}
+
+static uint32_t
+btf_proto(Dwarf_Die *die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die child, type;
+	struct btfbuf b = { 0 }, body = { 0 };
+	uint32_t ret;
+	size_t n;
+
+	ret = btf_ref(die);
+	n = 0;
+	if (dwarf_child(die, &child) == 0) {
+		do {
+			if (dwarf_tag(&child) == DW_TAG_formal_parameter) {
+				get_dwarf_attr(&child, DW_AT_type, &attr,
+				    &type);
+				btfbuf_u32(&body, 0);
+				btfbuf_u32(&body, btf_type(&type));
+				n++;
+			} else if (dwarf_tag(&child) ==
+			    DW_TAG_unspecified_parameters) {
+				/* Variadic: a last, void parameter. */
+				btfbuf_u32(&body, 0);
+				btfbuf_u32(&body, 0);
+				n++;
+			}
+		} while (n < BTF_MAX_VLEN &&
+		    dwarf_siblingof(&child, &child) == 0);
+	}
+
+	btf_hdr(&b, NULL, BTF_KIND_FUNC_PROTO, n, false, ret);
+	btfbuf_put(&b, body.v, body.n);
+	free(body.v);
+	return (btf_add(&b));
+}
+
+static uint32_t
+btf_type(Dwarf_Die *die)
+{
+	struct btfbuf b = { 0 };
+	Dwarf_Off off;
+	uint32_t id;
+	unsigned kind;
+
+	off = dwarf_dieoffset(die);
+	if ((id = btf_die_lookup(off)) != 0)
+		return (id);
+
+	switch (dwarf_tag(die)) {
+	case DW_TAG_base_type:
+		id = btf_base(die);
+		break;
+	case DW_TAG_pointer_type:
+	case DW_TAG_reference_type:
+	case DW_TAG_rvalue_reference_type:
+	case DW_TAG_const_type:
+	case DW_TAG_volatile_type:
+	case DW_TAG_restrict_type:
+	case DW_TAG_typedef:
+		switch (dwarf_tag(die)) {
+		case DW_TAG_const_type:
+			kind = BTF_KIND_CONST;
+			break;
+		case DW_TAG_volatile_type:
+			kind = BTF_KIND_VOLATILE;
+			break;
+		case DW_TAG_restrict_type:
+			kind = BTF_KIND_RESTRICT;
+			break;
+		case DW_TAG_typedef:
+			kind = BTF_KIND_TYPEDEF;
+			break;
+		default:
+			kind = BTF_KIND_PTR;
+			break;
+		}
+		btf_hdr(&b, kind == BTF_KIND_TYPEDEF ? dwarf_diename(die) :
+		    NULL, kind, 0, false, btf_ref(die));
+		id = btf_add(&b);
+		break;
+	case DW_TAG_atomic_type:
+		/* BTF has no _Atomic. */
+		id = btf_ref(die);
+		break;
+	case DW_TAG_array_type:
+		id = btf_array(die);
+		break;
+	case DW_TAG_structure_type:
+	case DW_TAG_class_type:
+	case DW_TAG_union_type:
+		id = btf_struct(die);
+		break;
+	case DW_TAG_enumeration_type:
+		id = btf_enum(die);
+		break;
+	case DW_TAG_subroutine_type:
+		id = btf_proto(die);
+		break;
+	default:
+		/* nullptr_t, pointers to members, ...: void. */
+		id = 0;
+		break;
+	}
+	if (id != 0)
+		btf_die_set(off, id);
+	return (id);
+}
+
+/*
+ * Where -E btf writes: the -E btf=<file> path, else the binary's base name
+ * plus ".btf" in the current directory, or for -H, "<structname>.btf" (or,
+ * with -a, the header's base name less its extension plus ".btf").
+ */
+static char *
+btf_path(const char *binary)
+{
+	const char *base, *p;
+	char *path;
+	size_t len, baselen;
+
+	if (btffile != NULL)
+		return (xstrdup(btffile));
+	if (header != NULL && !allstructs)
+		base = structname;
+	else {
+		base = header != NULL ? header : binary;
+		if ((p = strrchr(base, '/')) != NULL)
+			base = p + 1;
+	}
+	baselen = strlen(base);
+	if (header != NULL && allstructs && (p = strrchr(base, '.')) != NULL &&
+	    p != base)
+		baselen = p - base;
+	len = baselen + sizeof(".btf");
+	path = xcalloc(len, 1);
+	snprintf(path, len, "%.*s.btf", (int)baselen, base);
+	return (path);
+}
+
+/* Write the BTF of a binary and start afresh for the next one. */
+static void
+btf_write(const char *binary)
+{
+	struct btfbuf hdr = { 0 };
+	uint32_t typelen;
+	size_t i;
+	char *path;
+	FILE *fp;
+
+	if (btfstrs.n == 0)
+		btfbuf_put(&btfstrs, "", 1);
+	typelen = 0;
+	for (i = 0; i < nbtftypes; i++)
+		typelen += btftypes[i].rec.n;
+
+	path = btf_path(binary);
+	if (strcmp(path, "-") == 0)
+		fp = stdout;
+	else if ((fp = fopen(path, "w")) == NULL)
+		err(EX_CANTCREAT, "%s", path);
+
+	/* Version 1, no flags; the types, then the strings. */
+	btfbuf_int(&hdr, BTF_MAGIC, 2);
+	btfbuf_int(&hdr, 1, 1);
+	btfbuf_int(&hdr, 0, 1);
+	btfbuf_u32(&hdr, BTF_HDR_LEN);
+	btfbuf_u32(&hdr, 0);
+	btfbuf_u32(&hdr, typelen);
+	btfbuf_u32(&hdr, typelen);
+	btfbuf_u32(&hdr, btfstrs.n);
+	fwrite(hdr.v, 1, hdr.n, fp);
+	for (i = 0; i < nbtftypes; i++)
+		fwrite(btftypes[i].rec.v, 1, btftypes[i].rec.n, fp);
+	fwrite(btfstrs.v, 1, btfstrs.n, fp);
+	if (fp == stdout) {
+		if (fflush(fp) != 0 || ferror(fp))
+			err(EX_IOERR, "stdout");
+	} else {
+		if (ferror(fp) || fclose(fp) != 0)
+			err(EX_IOERR, "%s", path);
+		printf("/* %s: %zu types, %zu bytes */\n", path, nbtftypes,
+		    hdr.n + typelen + btfstrs.n);
+	}
+	free(hdr.v);
+	free(path);
+
+	for (i = 0; i < nbtftypes; i++) {
+		free(btftypes[i].rec.v);
+		free(btftypes[i].key.v);
+	}
+	nbtftypes = 0;
+	nbtftypelog = 0;
+	if (btftypehash != NULL)
+		memset(btftypehash, 0, btftypehashsz * sizeof(*btftypehash));
+	btfstrs.n = 0;
+	nbtfstrs = 0;
+	if (btfstrhash != NULL)
+		memset(btfstrhash, 0, btfstrhashsz * sizeof(*btfstrhash));
+	nbtfdielog = 0;
+	if (btfdies != NULL)
+		memset(btfdies, 0, btfdiessz * sizeof(*btfdies));
+}
+
+static void
+variant_rehash(void)
+{
+	size_t i, slot, newsz;
+
+	newsz = varhashsz ? varhashsz * 2 : 1024;
+	free(varhash);
+	varhash = xcalloc(newsz, sizeof(*varhash));
+	varhashsz = newsz;
+
+	for (i = 0; i < nvariants; i++) {
+		slot = variants[i].layout->hash & (varhashsz - 1);
+		while (varhash[slot] != 0)
+			slot = (slot + 1) & (varhashsz - 1);
+		varhash[slot] = i + 1;
+	}
+}
+
+/*
+ * Record a layout found in 'where'.  Layouts already seen (by hash) are
+ * freed and only the new location is remembered.
+ */
+static void
+variant_add(struct layout *lay, const char *where)
+{
+	struct variant *var;
+	size_t slot;
+
+	if (2 * (nvariants + 1) > varhashsz)
+		variant_rehash();
+
+	slot = lay->hash & (varhashsz - 1);
+	while (varhash[slot] != 0) {
+		var = &variants[varhash[slot] - 1];
+		if (var->layout->hash == lay->hash)
+			goto found;
+		slot = (slot + 1) & (varhashsz - 1);
+	}
+
+	if (nvariants == nvariantcap) {
+		nvariantcap = nvariantcap ? nvariantcap * 2 : 64;
+		variants = xreallocarray(variants, nvariantcap,
+		    sizeof(*variants));
+	}
+	var = &variants[nvariants++];
+	memset(var, 0, sizeof(*var));
+	var->layout = lay;
+	varhash[slot] = nvariants;
+	lay = NULL;
+
+found:
+	if (lay != NULL)
+		layout_free(lay);
+
+	/* Several CUs of one binary commonly share a layout. */
+	if (var->nwhere > 0 && var->where[var->nwhere - 1] == where)
+		return;
+	if (var->nwhere == var->wherecap) {
+		var->wherecap = var->wherecap ? var->wherecap * 2 : 4;
+		var->where = xreallocarray(var->where, var->wherecap,
+		    sizeof(*var->where));
+	}
+	var->where[var->nwhere++] = where;
+	lastwhere = where;
+}
+
+static void
+variants_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < nvariants; i++) {
+		layout_free(variants[i].layout);
+		free(variants[i].where);
+	}
+	nvariants = 0;
+	if (varhash != NULL)
+		memset(varhash, 0, varhashsz * sizeof(*varhash));
+	for (i = 0; i < ncudescs; i++)
+		free(cudescs[i]);
+	ncudescs = 0;
+}
+
+static int
+variant_cmp(const void *a, const void *b)
+{
+	const struct variant *va = a, *vb = b;
+	int rc;
+
+	rc = strcmp(va->layout->name, vb->layout->name);
+	if (rc != 0)
+		return (rc);
+	if (va->nwhere != vb->nwhere)
+		return (va->nwhere > vb->nwhere ? -1 : 1);
+	if (va->layout->hash != vb->layout->hash)
+		return (va->layout->hash < vb->layout->hash ? -1 : 1);
+	return (0);
+}
+
+static void
+print_variants(void)
+{
+	size_t i;
+
+	for (i = 0; i < nvariants; i++) {
+		if (exportfmt != NULL) {
+			if (i > 0)
+				printf("\n");
+			export_layout(variants[i].layout,
+			    variants[i].where[0]);
+			continue;
+		}
+		if (i > 0 && !quiet)
+			printf("\n");
+		if (!quiet)
+			layout_print(variants[i].layout);
+		run_reports(variants[i].layout);
+	}
+}
+
+/*
+ * Fleet report: each distinct layout of each struct is listed once, with
+ * every binary (or, with -C, CU) it occurs in, most widespread variant
+ * first.
+ */
+static void
+fleet_report(const char *unit, const char *units)
+{
+	struct variant *var;
+	size_t i, j, nvar;
+	unsigned k;
+
+	/* The hash index is invalidated by sorting; we are done with it. */
+	if (nvariants > 0)
+		qsort(variants, nvariants, sizeof(*variants), variant_cmp);
+
+	for (i = 0; i < nvariants; i = j) {
+		for (j = i + 1; j < nvariants; j++)
+			if (strcmp(variants[i].layout->name,
+			    variants[j].layout->name) != 0)
+				break;
+		nvar = j - i;
+
+		if (i > 0)
+			printf("\n");
+		printf("/* struct %s: %zu layout variant%s */\n",
+		    variants[i].layout->name, nvar, nvar == 1 ? "" : "s");
+
+		for (var = &variants[i]; var < &variants[j]; var++) {
+			printf("\n/* variant %zu of %zu, layout %016jx, in %u "
+			    "%s: */\n", (size_t)(var - &variants[i]) + 1,
+			    nvar, (uintmax_t)var->layout->hash, var->nwhere,
+			    var->nwhere == 1 ? unit : units);
+			for (k = 0; k < var->nwhere; k++)
+				printf("/*\t%s */\n", var->where[k]);
+			if (!quiet)
+				layout_print(var->layout);
+			run_reports(var->layout);
+		}
+	}
+}
+
+static void
+get_elf_pointer_size(Dwarf *dw)
+{
+	GElf_Ehdr ehdr;
+	Elf *elf;
+	char *elf_ident;
+	size_t elf_nident;
+
+	elf = dwarf_getelf(dw);
+
+	elf_ident = elf_getident(elf, &elf_nident);
+	assert(elf_ident != NULL && elf_nident > EI_DATA);
+
+	/* i386 aligns 8-byte scalars to 4 inside structs. */
+	if (gelf_getehdr(elf, &ehdr) == NULL)
+		errx(EX_DATAERR, "gelf_getehdr: %s", elf_errmsg(-1));
+	max_scalar_align = ehdr.e_machine == EM_386 ? 4 : 16;
+
+	bigendian = (uint8_t)elf_ident[EI_DATA] == ELFDATA2MSB;
+
+	switch ((uint8_t)elf_ident[EI_CLASS]) {
+	case ELFCLASS32:
+		pointer_size = 4;
+		break;
+	case ELFCLASS64:
+		pointer_size = 8;
+		break;
+	case ELFCLASSNONE:
+	default:
+		errx(EX_DATAERR, "Bogus ELF ident header, machine class=%u.\n",
+		    (unsigned)elf_ident[EI_CLASS]);
+	}
+}
+
+/*
+ * Struct 'die' in namespace 'ns' matches by its bare name or by its
+ * qualified 'ns::name'.
+ */
+static bool
+wantstruct(Dwarf_Die *die, const char *ns)
+{
+	const char *name, *want;
+	size_t i, nslen;
+
+	if (!isstruct(dwarf_tag(die)) || !dwarf_haschildren(die) ||
+	    (name = dwarf_diename(die)) == NULL)
+		return (false);
+	if (allstructs)
+		return (true);
+	for (i = 0; i < structnames.n; i++) {
+		want = structnames.v[i];
+		if (strcmp(name, want) == 0)
+			return (true);
+		if (ns == NULL)
+			continue;
+		nslen = strlen(ns);
+		if (strncmp(want, ns, nslen) == 0 &&
+		    strncmp(want + nslen, "::", 2) == 0 &&
+		    strcmp(want + nslen + 2, name) == 0)
+			return (true);
+	}
+	return (false);
+}
+
+/* Namespace path of the children of DW_TAG_namespace 'die'. */
+static char *
+namespace_path(Dwarf_Die *die, const char *ns)
+{
+
+	return (qualname(ns, dwarf_diename(die) != NULL ?
+	    dwarf_diename(die) : "(anonymous namespace)"));
+}
+
+/* Is 'type_die' const, looking through typedefs and other qualifiers? */
+static bool
+type_isconst(Dwarf_Die *type_die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die t;
+
+	t = *type_die;
+	for (;;) {
+		if (dwarf_tag(&t) == DW_TAG_const_type)
+			return (true);
+		if ((!isqualifier(dwarf_tag(&t)) &&
+		    dwarf_tag(&t) != DW_TAG_typedef) ||
+		    dwarf_attr(&t, DW_AT_type, &attr) == NULL ||
+		    dwarf_formref_die(&attr, &t) == NULL)
+			return (false);
+	}
+}
+
+static unsigned
+type_composition(Dwarf_Die *type_die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die t, memdie, mtype, pt;
+	unsigned n, nfn, nconst, comp;
+
+	if (dwarf_peel_type(type_die, &t) != 0)
+		return (0);
+	while (dwarf_tag(&t) == DW_TAG_array_type)
+		if (dwarf_attr(&t, DW_AT_type, &attr) == NULL ||
+		    dwarf_formref_die(&attr, &mtype) == NULL ||
+		    dwarf_peel_type(&mtype, &t) != 0)
+			return (0);
+	if (!isstruct(dwarf_tag(&t)) || dwarf_child(&t, &memdie) != 0)
+		return (0);
+
+	n = nfn = nconst = 0;
+	do {
+		if (dwarf_tag(&memdie) != DW_TAG_member)
+			continue;
+		n++;
+		if (dwarf_attr_integrate(&memdie, DW_AT_type, &attr) == NULL ||
+		    dwarf_formref_die(&attr, &mtype) == NULL)
+			continue;
+		if (type_isconst(&mtype))
+			nconst++;
+		if (dwarf_peel_type(&mtype, &pt) == 0 &&
+		    dwarf_tag(&pt) == DW_TAG_pointer_type &&
+		    dwarf_attr(&pt, DW_AT_type, &attr) != NULL &&
+		    dwarf_formref_die(&attr, &mtype) != NULL &&
+		    dwarf_peel_type(&mtype, &pt) == 0 &&
+		    dwarf_tag(&pt) == DW_TAG_subroutine_type)
+			nfn++;
+	} while (dwarf_siblingof(&memdie, &memdie) == 0);
+
+	comp = 0;
+	if (n > 0 && nfn == n)
+		comp |= GV_FNPTRS;
+	if (n > 0 && nconst == n)
+		comp |= GV_ALLCONST;
+	return (comp);
+}
+
+static void
+sections_load(Elf *elf)
+{
+	struct section *sec;
+	GElf_Shdr shdr;
+	Elf_Scn *scn;
+	size_t shstrndx;
+	const char *name;
+
+	if (elf_getshdrstrndx(elf, &shstrndx) != 0)
+		return;
+	for (scn = NULL; (scn = elf_nextscn(elf, scn)) != NULL; ) {
+		if (gelf_getshdr(scn, &shdr) == NULL ||
+		    (shdr.sh_flags & SHF_ALLOC) == 0 || shdr.sh_size == 0 ||
+		    (name = elf_strptr(elf, shstrndx, shdr.sh_name)) == NULL)
+			continue;
+		if (nsections == nsectioncap) {
+			nsectioncap = nsectioncap ? nsectioncap * 2 : 32;
+			sections = xreallocarray(sections, nsectioncap,
+			    sizeof(*sections));
+		}
+		sec = &sections[nsections++];
+		sec->name = xstrdup(name);
+		sec->addr = shdr.sh_addr;
+		sec->size = shdr.sh_size;
+		sec->write = (shdr.sh_flags & SHF_WRITE) != 0;
+		sec->nobits = shdr.sh_type == SHT_NOBITS;
+	}
+}
+
+#ifndef SHT_RELR
+#define	SHT_RELR	19
+#endif
+
+static void
+reloc_add(Dwarf_Addr addr)
+{
+
+	if (nrelocs == nreloccap) {
+		nreloccap = nreloccap ? nreloccap * 2 : 1024;
+		relocs = xreallocarray(relocs, nreloccap, sizeof(*relocs));
+	}
+	relocs[nrelocs++] = addr;
+}
+
+/*
+ * RELR: an even word is an address to relocate; an odd word is a bitmap of
+ * the next 63 (or 31) words after the last address.
+ */
+static void
+relr_load(Elf_Data *data)
+{
+	const unsigned char *p;
+	Dwarf_Addr where, word;
+	size_t i, k, wbits;
+
+	wbits = pointer_size * 8;
+	where = 0;
+	for (i = 0; i + pointer_size <= data->d_size; i += pointer_size) {
+		p = (const unsigned char *)data->d_buf + i;
+		word = 0;
+		for (k = 0; k < pointer_size; k++)
+			word |= (Dwarf_Addr)p[k] << (8 * (bigendian ?
+			    pointer_size - 1 - k : k));
+		if ((word & 1) == 0) {
+			reloc_add(word);
+			where = word + pointer_size;
+			continue;
+		}
+		for (k = 0, word >>= 1; word != 0; word >>= 1, k++)
+			if ((word & 1) != 0)
+				reloc_add(where + k * pointer_size);
+		where += (wbits - 1) * pointer_size;
+	}
+}
+
+static void
+relocs_load(Elf *elf)
+{
+	GElf_Shdr shdr;
+	GElf_Rela rela;
+	GElf_Rel rel;
+	Elf_Scn *scn;
+	Elf_Data *data;
+	size_t shstrndx, i, n;
+	const char *name;
+
+	if (elf_getshdrstrndx(elf, &shstrndx) != 0)
+		return;
+	for (scn = NULL; (scn = elf_nextscn(elf, scn)) != NULL; ) {
+		if (gelf_getshdr(scn, &shdr) == NULL ||
+		    (name = elf_strptr(elf, shstrndx, shdr.sh_name)) == NULL ||
+		    (data = elf_getdata(scn, NULL)) == NULL)
+			continue;
+		if (shdr.sh_type == SHT_RELR) {
+			relr_load(data);
+			continue;
+		}
+		/* Not .rela.plt: its targets are PLT GOT slots. */
+		if ((shdr.sh_type != SHT_RELA && shdr.sh_type != SHT_REL) ||
+		    (shdr.sh_flags & SHF_ALLOC) == 0 || shdr.sh_entsize == 0 ||
+		    strstr(name, ".plt") != NULL)
+			continue;
+		n = shdr.sh_size / shdr.sh_entsize;
+		for (i = 0; i < n; i++) {
+			if (shdr.sh_type == SHT_RELA &&
+			    gelf_getrela(data, i, &rela) != NULL)
+				reloc_add(rela.r_offset);
+			else if (shdr.sh_type == SHT_REL &&
+			    gelf_getrel(data, i, &rel) != NULL)
+				reloc_add(rel.r_offset);
+		}
+	}
+}
+
+static void
+symbols_load(Elf *elf)
+{
+	struct symbol *sym;
+	GElf_Shdr shdr;
+	GElf_Sym st;
+	Elf_Scn *scn, *symscn;
+	Elf_Data *data;
+	const char *name;
+	size_t i, n;
+
+	/* Prefer the full symbol table. */
+	symscn = NULL;
+	for (scn = NULL; (scn = elf_nextscn(elf, scn)) != NULL; ) {
+		if (gelf_getshdr(scn, &shdr) == NULL)
+			continue;
+		if (shdr.sh_type == SHT_SYMTAB ||
+		    (shdr.sh_type == SHT_DYNSYM && symscn == NULL))
+			symscn = scn;
+	}
+	if (symscn == NULL || gelf_getshdr(symscn, &shdr) == NULL ||
+	    shdr.sh_entsize == 0 || (data = elf_getdata(symscn, NULL)) == NULL)
+		return;
+
+	n = shdr.sh_size / shdr.sh_entsize;
+	for (i = 1; i < n; i++) {
+		if (gelf_getsym(data, i, &st) == NULL ||
+		    GELF_ST_TYPE(st.st_info) != STT_OBJECT || st.st_size == 0 ||
+		    st.st_shndx == SHN_UNDEF ||
+		    (name = elf_strptr(elf, shdr.sh_link, st.st_name)) == NULL)
+			continue;
+		if (nsymbols == nsymbolcap) {
+			nsymbolcap = nsymbolcap ? nsymbolcap * 2 : 256;
+			symbols = xreallocarray(symbols, nsymbolcap,
+			    sizeof(*symbols));
+		}
+		sym = &symbols[nsymbols++];
+		sym->name = xstrdup(name);
+		sym->addr = st.st_value;
+		sym->size = st.st_size;
+	}
+}
+
+/* Layout of a struct type or of an array's struct element type. */
+static struct layout *
+global_layout(Dwarf *dw, Dwarf_Die *type_die)
+{
+	Dwarf_Attribute attr;
+	Dwarf_Die t, elem;
+
+	if (dwarf_peel_type(type_die, &t) != 0)
+		return (NULL);
+	while (dwarf_tag(&t) == DW_TAG_array_type)
+		if (dwarf_attr(&t, DW_AT_type, &attr) == NULL ||
+		    dwarf_formref_die(&attr, &elem) == NULL ||
+		    dwarf_peel_type(&elem, &t) != 0)
+			return (NULL);
+	if (!isstruct(dwarf_tag(&t)) || !dwarf_haschildren(&t))
+		return (NULL);
+	return (structprobe(dw, &t, NULL));
+}
+
+static void
+global_add(Dwarf *dw, Dwarf_Die *die)
+{
+	struct global *gv;
+	struct typeinfo ti;
+	Dwarf_Attribute attr;
+	Dwarf_Die type_die;
+	Dwarf_Op *expr;
+	size_t exprlen;
+
+	/* Only definitions; a C++ definition refers to its declaration. */
+	if (dwarf_hasattr(die, DW_AT_declaration) ||
+	    dwarf_diename(die) == NULL ||
+	    dwarf_attr_integrate(die, DW_AT_type, &attr) == NULL ||
+	    dwarf_formref_die(&attr, &type_die) == NULL)
+		return;
+
+	get_type_info(&type_die, &ti);
+
+	if (nglobals == nglobalcap) {
+		nglobalcap = nglobalcap ? nglobalcap * 2 : 256;
+		globals = xreallocarray(globals, nglobalcap, sizeof(*globals));
+	}
+	gv = &globals[nglobals++];
+	memset(gv, 0, sizeof(*gv));
+	gv->name = xstrdup(dwarf_diename(die));
+	gv->type_name = xstrdup(ti.name);
+	gv->size = ti.size;
+	gv->align = ti.align;
+	gv->flags = ti.flags;
+	gv->nelems = ti.nelems;
+	gv->elemsize = ti.elemsize;
+	gv->comp = type_composition(&type_die);
+	if (wantgvlayouts)
+		gv->layout = global_layout(dw, &type_die);
+
+	if (dwarf_attr(die, DW_AT_location, &attr) != NULL &&
+	    dwarf_getlocation(&attr, &expr, &exprlen) == 0 &&
+	    exprlen >= 1 && expr[0].atom == DW_OP_addr) {
+		gv->addr = expr[0].number;
+		gv->hasaddr = true;
+	}
+}
+
+static void
+globals_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < nglobals; i++) {
+		free(globals[i].name);
+		free(globals[i].type_name);
+		if (globals[i].layout != NULL)
+			layout_free(globals[i].layout);
+	}
+	nglobals = 0;
+	nrelocs = 0;
+	for (i = 0; i < nsections; i++)
+		free(sections[i].name);
+	nsections = 0;
+	for (i = 0; i < nsymbols; i++)
+		free(symbols[i].name);
+	nsymbols = 0;
+}
+
+/*
+ * Scan a chain of sibling DIEs, starting at 'die', for wanted structs and,
+ * if a report needs them, global variables.  Namespaces (C++, Rust) are
+ * descended into.  Layouts found are attributed to 'where', the binary or,
+ * with -C, the CU.
+ */
+static void
+scan_dies(Dwarf *dw, Dwarf_Die *die, const char *where, const char *ns)
+{
+	Dwarf_Die child;
+	char *path;
+	int x;
+
+	do {
+		if (dwarf_tag(die) == DW_TAG_namespace &&
+		    dwarf_child(die, &child) == 0) {
+			path = namespace_path(die, ns);
+			scan_dies(dw, &child, where, path);
+			free(path);
+			if (lookup_done && !wantvars)
+				return;
+			continue;
+		}
+		if (wantvars && dwarf_tag(die) == DW_TAG_variable)
+			global_add(dw, die);
+		if (lookup_done || !wantstruct(die, ns))
+			continue;
+
+		variant_add(structprobe(dw, die, ns), where);
+		if (btfout)
+			(void)btf_type(die);
+		if (!findall) {
+			lookup_done = true;
+			if (!wantvars)
+				return;
+		}
+	} while ((x = dwarf_siblingof(die, die)) == 0);
+	if (x == -1)
+		dwarf_err(EX_DATAERR, "dwarf_siblingof");
+}
+
+/*
+ * -t: where the time went.  The main thread walks the CUs and takes the
+ * page faults; the time it is neither on a CPU nor waiting for workers is
+ * counted as I/O wait.
+ */
+struct timing {
+	struct timespec	 wall, cpu;
+	struct rusage	 ru;
+};
+
+static double
+ts_diff(const struct timespec *a, const struct timespec *b)
+{
+
+	return ((double)(a->tv_sec - b->tv_sec) +
+	    (double)(a->tv_nsec - b->tv_nsec) / 1e9);
+}
+
+static double
+tv_diff(const struct timeval *a, const struct timeval *b)
+{
+
+	return ((double)(a->tv_sec - b->tv_sec) +
+	    (double)(a->tv_usec - b->tv_usec) / 1e6);
+}
+
+static void
+timing_begin(struct timing *t)
+{
+
+	parwait = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t->wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->cpu);
+	getrusage(RUSAGE_SELF, &t->ru);
+}
+
+static void
+timing_end(const char *what, const struct timing *t0)
+{
+	struct timing t1;
+	double wall, cpu, maincpu, iowait;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1.wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1.cpu);
+	getrusage(RUSAGE_SELF, &t1.ru);
+
+	wall = ts_diff(&t1.wall, &t0->wall);
+	maincpu = ts_diff(&t1.cpu, &t0->cpu);
+	cpu = tv_diff(&t1.ru.ru_utime, &t0->ru.ru_utime) +
+	    tv_diff(&t1.ru.ru_stime, &t0->ru.ru_stime);
+	iowait = MAX(wall - maincpu - parwait, 0);
+	warnx("%s: %.3fs wall, %.3fs cpu, %.3fs I/O wait, %ld major faults, "
+	    "%ld blocks read", what, wall, cpu, iowait,
+	    t1.ru.ru_majflt - t0->ru.ru_majflt,
+	    t1.ru.ru_inblock - t0->ru.ru_inblock);
+}
+
+/*
+ * Intra-CU parallelism.  With full LTO a handful of CUs hold nearly every
+ * DIE, so handing out whole CUs does not scale.  Instead, a serial pre-pass
+ * walks a large CU's top-level DIE chain (dwarf_siblingof() follows
+ * DW_AT_sibling where present and skips children by abbrev otherwise) and
+ * collects candidate struct DIEs; the candidates are cut into chunks that
+ * worker threads scan concurrently.  Results are merged in chunk order, so
+ * the output is the same as a serial scan.
+ *
+ * libdw handles must not be shared between threads; each worker opens its
+ * own Dwarf handle on the binary.
+ */
+#define	PAR_MIN_CU_SIZE		(1024 * 1024)
+#define	PAR_CHUNKS_PER_THREAD	8
+
+struct chunk {
+	size_t		 first, last;	/* Candidate indices [first, last) */
+	struct layout	**found;
+	size_t		 nfound, foundcap;
+};
+
+struct cand {
+	Dwarf_Off	 off;
+	const char	*ns;		/* Points into parscan.nss */
+};
+
+struct parscan {
+	struct cand	*cand;
+	size_t		 ncand, candcap;
+	char		**nss;		/* Namespace paths seen */
+	size_t		 nns, nscap;
+	struct chunk	*chunks;
+	size_t		 nchunks;
+
+	pthread_mutex_t	 lock;
+	size_t		 nextchunk;	/* Next chunk to hand out */
+	size_t		 firsthit;	/* Lookup: lowest chunk with a match */
+};
+
+struct worker {
+	pthread_t	 thread;
+	Dwarf		*dw;
+	struct parscan	*ps;
+};
+
+static void *
+scan_worker(void *arg)
+{
+	struct worker *wk = arg;
+	struct parscan *ps = wk->ps;
+	struct chunk *ch;
+	Dwarf_Die die;
+	size_t c, i;
+	bool stop;
+
+	for (;;) {
+		pthread_mutex_lock(&ps->lock);
+		c = ps->nextchunk++;
+		/* Chunks go out in order; nothing after a hit matters. */
+		stop = c >= ps->nchunks || c > ps->firsthit;
+		pthread_mutex_unlock(&ps->lock);
+		if (stop)
+			break;
+
+		ch = &ps->chunks[c];
+		for (i = ch->first; i < ch->last; i++) {
+			if (dwarf_offdie(wk->dw, ps->cand[i].off, &die) ==
+			    NULL)
+				dwarf_err(EX_DATAERR, "dwarf_offdie");
+			if (!wantstruct(&die, ps->cand[i].ns))
+				continue;
+
+			if (ch->nfound == ch->foundcap) {
+				ch->foundcap = ch->foundcap ?
+				    ch->foundcap * 2 : 16;
+				ch->found = xreallocarray(ch->found,
+				    ch->foundcap, sizeof(*ch->found));
+			}
+			ch->found[ch->nfound++] = structprobe(wk->dw, &die,
+			    ps->cand[i].ns);
+
+			if (!findall) {
+				pthread_mutex_lock(&ps->lock);
+				if (c < ps->firsthit)
+					ps->firsthit = c;
+				pthread_mutex_unlock(&ps->lock);
+				break;
+			}
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Pre-pass: sibling hops only, no attribute decoding.  Variables are cheap,
+ * so they are collected here rather than by the workers.
+ */
+static void
+collect_candidates(Dwarf *dw, struct parscan *ps, Dwarf_Die *die,
+    const char *ns)
+{
+	Dwarf_Die child;
+	char *path;
+	int x;
+
+	do {
+		if (dwarf_tag(die) == DW_TAG_namespace &&
+		    dwarf_child(die, &child) == 0) {
+			path = namespace_path(die, ns);
+			if (ps->nns == ps->nscap) {
+				ps->nscap = ps->nscap ? ps->nscap * 2 : 16;
+				ps->nss = xreallocarray(ps->nss, ps->nscap,
+				    sizeof(*ps->nss));
+			}
+			ps->nss[ps->nns++] = path;
+			collect_candidates(dw, ps, &child, path);
+			continue;
+		}
+		if (wantvars && dwarf_tag(die) == DW_TAG_variable)
+			global_add(dw, die);
+		if (lookup_done || !isstruct(dwarf_tag(die)) ||
+		    !dwarf_haschildren(die))
+			continue;
+		if (ps->ncand == ps->candcap) {
+			ps->candcap = ps->candcap ? ps->candcap * 2 : 1024;
+			ps->cand = xreallocarray(ps->cand, ps->candcap,
+			    sizeof(*ps->cand));
+		}
+		ps->cand[ps->ncand].off = dwarf_dieoffset(die);
+		ps->cand[ps->ncand++].ns = ns;
+	} while ((x = dwarf_siblingof(die, die)) == 0);
+	if (x == -1)
+		dwarf_err(EX_DATAERR, "dwarf_siblingof");
+}
+
+static void
+scan_dies_parallel(Dwarf *dw, Dwarf_Die *die, const char *where,
+    struct worker *workers)
+{
+	struct parscan ps;
+	struct chunk *ch;
+	struct timespec t0, t1;
+	size_t c, i, per;
+	unsigned t;
+	int error;
+
+	memset(&ps, 0, sizeof(ps));
+	collect_candidates(dw, &ps, die, NULL);
+
+	ps.nchunks = (size_t)nthreads * PAR_CHUNKS_PER_THREAD;
+	if (ps.nchunks > ps.ncand)
+		ps.nchunks = ps.ncand;
+	if (ps.nchunks == 0)
+		goto out;
+	per = (ps.ncand + ps.nchunks - 1) / ps.nchunks;
+	ps.chunks = xcalloc(ps.nchunks, sizeof(*ps.chunks));
+	for (c = 0; c < ps.nchunks; c++) {
+		ps.chunks[c].first = c * per;
+		ps.chunks[c].last = c * per + per;
+		if (ps.chunks[c].last > ps.ncand)
+			ps.chunks[c].last = ps.ncand;
+	}
+	ps.firsthit = SIZE_MAX;
+	pthread_mutex_init(&ps.lock, NULL);
+
+	for (t = 0; t < nthreads; t++) {
+		workers[t].ps = &ps;
+		error = pthread_create(&workers[t].thread, NULL, scan_worker,
+		    &workers[t]);
+		if (error != 0) {
+			errno = error;
+			err(EX_OSERR, "pthread_create");
+		}
+	}
+	if (timing)
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (t = 0; t < nthreads; t++)
+		pthread_join(workers[t].thread, NULL);
+	if (timing) {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		parwait += ts_diff(&t1, &t0);
+	}
+	pthread_mutex_destroy(&ps.lock);
+
+	for (c = 0; c < ps.nchunks; c++) {
+		ch = &ps.chunks[c];
+		for (i = 0; i < ch->nfound; i++) {
+			if (lookup_done)
+				layout_free(ch->found[i]);
+			else
+				variant_add(ch->found[i], where);
+		}
+		if (ch->nfound > 0 && !findall)
+			lookup_done = true;
+		free(ch->found);
+	}
+	free(ps.chunks);
+out:
+	for (i = 0; i < ps.nns; i++)
+		free(ps.nss[i]);
+	free(ps.nss);
+	free(ps.cand);
+}
+
+/*
+ * The debug sections of a relocatable object (e.g. a header stub, see -H)
+ * hold unapplied relocations, string offsets among them; libdwfl applies
+ * them.
+ */
+static Dwarf *
+dwarf_begin_rel(const char *binary, Dwfl **dwflp)
+{
+	static const Dwfl_Callbacks offline_callbacks = {
+		.find_debuginfo = dwfl_standard_find_debuginfo,
+		.section_address = dwfl_offline_section_address,
+	};
+	Dwfl_Module *mod;
+	Dwarf_Addr bias;
+	Dwarf *dw;
+
+	if ((*dwflp = dwfl_begin(&offline_callbacks)) == NULL)
+		errx(EX_SOFTWARE, "dwfl_begin: %s", dwfl_errmsg(-1));
+	mod = dwfl_report_offline(*dwflp, binary, binary, -1);
+	if (mod == NULL || dwfl_report_end(*dwflp, NULL, NULL) != 0)
+		errx(EX_DATAERR, "%s: %s", binary, dwfl_errmsg(-1));
+	if ((dw = dwfl_module_getdwarf(mod, &bias)) == NULL)
+		errx(EX_DATAERR, "%s: %s", binary, dwfl_errmsg(-1));
+	return (dw);
+}
+
+/*
+ * I/O hints for cold page caches and network filesystems.  libelf maps the
+ * file; left alone, the CU walk faults it in 4K at a time.  The small,
+ * randomly accessed sections (abbreviations, strings) are read ahead up
+ * front, and .debug_info is read ahead in windows ahead of the CU cursor.
+ * MADV_WILLNEED starts asynchronous readahead and returns.
+ */
+#define	IO_WINDOW	(16 * 1024 * 1024)	/* Read ahead this far */
+#define	IO_STEP		(4 * 1024 * 1024)	/* ... in steps this big */
+
+struct ioahead {
+	char		*base;		/* File image, page aligned */
+	size_t		 size;
+	size_t		 info, infosize; /* .debug_info in the file */
+	size_t		 done;		/* Read ahead up to here */
+};
+
+static void
+io_advise(struct ioahead *io, size_t off, size_t len, int advice)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t start, end;
+
+	start = off - off % pgsz;
+	end = MIN(off + len, io->size);
+	if (end > start)
+		(void)madvise(io->base + start, end - start, advice);
+}
+
+static void
+io_begin(struct ioahead *io, Dwarf *dw)
+{
+	static const char *const randsecs[] = {
+		".debug_abbrev", ".debug_str", ".debug_str_offsets",
+		".debug_line_str",
+	};
+	GElf_Shdr shdr;
+	Elf_Scn *scn;
+	Elf *elf;
+	size_t shstrndx, i;
+	const char *name;
+
+	memset(io, 0, sizeof(*io));
+	elf = dwarf_getelf(dw);
+	io->base = elf_rawfile(elf, &io->size);
+	if (io->base == NULL || elf_getshdrstrndx(elf, &shstrndx) != 0 ||
+	    ((uintptr_t)io->base & (getpagesize() - 1)) != 0) {
+		io->base = NULL;
+		return;
+	}
+
+	for (scn = NULL; (scn = elf_nextscn(elf, scn)) != NULL; ) {
+		if (gelf_getshdr(scn, &shdr) == NULL ||
+		    shdr.sh_type == SHT_NOBITS ||
+		    (name = elf_strptr(elf, shstrndx, shdr.sh_name)) == NULL)
+			continue;
+		if (strcmp(name, ".debug_info") == 0) {
+			io->info = shdr.sh_offset;
+			io->infosize = shdr.sh_size;
+			io_advise(io, shdr.sh_offset, shdr.sh_size,
+			    MADV_SEQUENTIAL);
+			continue;
+		}
+		for (i = 0; i < nitems(randsecs); i++)
+			if (strcmp(name, randsecs[i]) == 0)
+				io_advise(io, shdr.sh_offset, shdr.sh_size,
+				    MADV_WILLNEED);
+	}
+}
+
+/* The CU walk has reached 'cuoff' in .debug_info. */
+static void
+io_advance(struct ioahead *io, Dwarf_Off cuoff)
+{
+	size_t want;
+
+	if (io->base == NULL || io->done >= io->infosize)
+		return;
+	want = MIN(cuoff + IO_WINDOW, io->infosize);
+	if (want < io->done + IO_STEP && want < io->infosize)
+		return;
+	io_advise(io, io->info + io->done, want - io->done, MADV_WILLNEED);
+	io->done = want;
+}
+
+/*
+ * CU filters (-u, -l, -p).  Only the CU DIE's own attributes are read, so
+ * the children of CUs that don't match are never decoded.
+ */
+static const struct {
+	const char	*name;
+	unsigned	 lang;
+} languages[] = {
+	{ "c", DW_LANG_C89 }, { "c", DW_LANG_C }, { "c", DW_LANG_C99 },
+	{ "c", DW_LANG_C11 }, { "c", 0x2c /* C17 */ },
+	{ "c++", DW_LANG_C_plus_plus }, { "c++", DW_LANG_C_plus_plus_03 },
+	{ "c++", DW_LANG_C_plus_plus_11 }, { "c++", DW_LANG_C_plus_plus_14 },
+	{ "c++", 0x2a /* C++17 */ }, { "c++", 0x2b /* C++20 */ },
+	{ "objc", DW_LANG_ObjC }, { "objc++", DW_LANG_ObjC_plus_plus },
+	{ "rust", DW_LANG_Rust }, { "go", DW_LANG_Go },
+	{ "fortran", DW_LANG_Fortran77 }, { "fortran", DW_LANG_Fortran90 },
+	{ "fortran", DW_LANG_Fortran95 }, { "fortran", DW_LANG_Fortran03 },
+	{ "fortran", DW_LANG_Fortran08 },
+	{ "asm", DW_LANG_Mips_Assembler },
+};
+
+static void
+culangs_enable(char *list)
+{
+	char *name;
+	size_t i;
+	bool found;
+
+	while ((name = strsep(&list, ",")) != NULL) {
+		found = false;
+		for (i = 0; i < nitems(languages); i++)
+			if (strcmp(name, languages[i].name) == 0) {
+				culangs |= 1ull << i;
+				found = true;
+			}
+		if (!found)
+			errx(EX_USAGE, "unknown language: %s", name);
+	}
+}
+
+static bool
+glob_any(const struct strlist *globs, const char *s)
+{
+	size_t i;
+
+	for (i = 0; i < globs->n; i++)
+		if (s != NULL && fnmatch(globs->v[i], s, 0) == 0)
+			return (true);
+	return (false);
+}
+
+static bool
+cu_wanted(Dwarf_Die *cu_die)
+{
+	Dwarf_Attribute attr;
+	const char *name, *dir;
+	char path[PATH_MAX];
+	size_t i;
+	int lang;
+
+	if (culangs != 0) {
+		lang = dwarf_srclang(cu_die);
+		for (i = 0; i < nitems(languages); i++)
+			if ((culangs & (1ull << i)) != 0 &&
+			    languages[i].lang == (unsigned)lang)
+				break;
+		if (i == nitems(languages))
+			return (false);
+	}
+	if (cuprods.n > 0 && !glob_any(&cuprods, dwarf_formstring(
+	    dwarf_attr(cu_die, DW_AT_producer, &attr))))
+		return (false);
+	if (cunames.n > 0) {
+		name = dwarf_diename(cu_die);
+		dir = dwarf_formstring(dwarf_attr(cu_die, DW_AT_comp_dir,
+		    &attr));
+		if (glob_any(&cunames, name) || glob_any(&cunames, dir))
+			return (true);
+		if (name == NULL || name[0] == '/' || dir == NULL)
+			return (false);
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		return (glob_any(&cunames, path));
+	}
+	return (true);
+}
+
+/* -C: "src/foo.c (GNU C11 12.2.0 -O2)", prefixed by the binary with -F. */
+static char *
+cu_describe(const char *binary, Dwarf_Die *cu_die)
+{
+	Dwarf_Attribute attr;
+	const char *name, *producer;
+	char *desc;
+	size_t len;
+
+	name = dwarf_diename(cu_die);
+	producer = dwarf_formstring(dwarf_attr(cu_die, DW_AT_producer,
+	    &attr));
+	len = strlen(binary) + (name ? strlen(name) : 5) +
+	    (producer ? strlen(producer) : 0) + 8;
+	desc = xcalloc(1, len);
+	snprintf(desc, len, "%s%s%s%s%s%s", fleet ? binary : "",
+	    fleet ? ": " : "", name ? name : "<cu>",
+	    producer ? " (" : "", producer ? producer : "",
+	    producer ? ")" : "");
+
+	if (ncudescs == ncudesccap) {
+		ncudesccap = ncudesccap ? ncudesccap * 2 : 64;
+		cudescs = xreallocarray(cudescs, ncudesccap,
+		    sizeof(*cudescs));
+	}
+	cudescs[ncudescs++] = desc;
+	return (desc);
+}
+
+static void
+scan_binary(const char *binary)
+{
+	struct ioahead io;
+	const char *where;
+	struct worker *workers;
+	Dwarf_Off off, lastoff;
+	GElf_Ehdr ehdr;
+	Dwarf *dw;
+	Dwfl *dwfl;
+
+	size_t hdr_size;
+	unsigned t;
+	int cufd, error;
+
+	cufd = open(binary, O_RDONLY);
+	if (cufd == -1)
+		err(EX_USAGE, "open");
+
+	dw = dwarf_begin(cufd, DWARF_C_READ);
+	if (dw == NULL) {
+		error = dwarf_errno();
+		if (error == DWARF_E_NO_REGFILE)
+			errx(EX_USAGE, "%s: Not a regular file", binary);
+		dwarf_err_errno(EX_DATAERR, error, "dwarf_begin");
+	}
+
+	dwfl = NULL;
+	if (gelf_getehdr(dwarf_getelf(dw), &ehdr) != NULL &&
+	    ehdr.e_type == ET_REL) {
+		if (dwarf_end(dw))
+			dwarf_err(EX_SOFTWARE, "dwarf_end");
+		dw = dwarf_begin_rel(binary, &dwfl);
+	}
+
+	get_elf_pointer_size(dw);
+	lookup_done = false;
+	if (dwfl == NULL)
+		io_begin(&io, dw);
+	else
+		io.base = NULL;
+	if (wantvars && dwfl == NULL) {
+		sections_load(dwarf_getelf(dw));
+		symbols_load(dwarf_getelf(dw));
+		relocs_load(dwarf_getelf(dw));
+	}
+
+	/* Objects are small; their DWARF is not worth splitting up. */
+	workers = NULL;
+	if (nthreads > 1 && dwfl == NULL) {
+		workers = xcalloc(nthreads, sizeof(*workers));
+		for (t = 0; t < nthreads; t++) {
+			workers[t].dw = dwarf_begin(cufd, DWARF_C_READ);
+			if (workers[t].dw == NULL)
+				dwarf_err(EX_DATAERR, "dwarf_begin");
+		}
+	}
+
+	/* XXX worry about .debug_types sections later. */
+
+	lastoff = off = 0;
+	while (dwarf_nextcu(dw, off, &off, &hdr_size, NULL, NULL, NULL) == 0) {
+		Dwarf_Die cu_die, die;
+		Dwarf_Off cusize;
+
+		if (dwarf_offdie(dw, lastoff + hdr_size, &cu_die) == NULL)
+			continue;
+		cusize = off - lastoff;
+		lastoff = off;
+		io_advance(&io, off);
+
+		/*
+		 * A CU may be empty because e.g. an empty (or fully #if0'd)
+		 * file is compiled.
+		 */
+		if (dwarf_child(&cu_die, &die) || !cu_wanted(&cu_die))
+			continue;
+
+		where = binary;
+		lastwhere = NULL;
+		if (cuvariants)
+			where = cu_describe(binary, &cu_die);
+
+		/* Loop through all DIEs in the CU. */
+		if (workers != NULL && cusize >= PAR_MIN_CU_SIZE)
+			scan_dies_parallel(dw, &die, where, workers);
+		else
+			scan_dies(dw, &die, where, NULL);
+
+		/* Keep only descriptions of CUs that had a match. */
+		if (cuvariants && lastwhere != where)
+			free(cudescs[--ncudescs]);
+		if (lookup_done && !wantvars)
+			break;
+	}
+
+	if (workers != NULL) {
+		for (t = 0; t < nthreads; t++)
+			if (dwarf_end(workers[t].dw))
+				dwarf_err(EX_SOFTWARE, "dwarf_end");
+		free(workers);
+	}
+	if (dwfl != NULL)
+		dwfl_end(dwfl);
+	else if (dwarf_end(dw))
+		dwarf_err(EX_SOFTWARE, "dwarf_end");
+	close(cufd);
+}
+
+/*
+ * Compiler record-layout dumps, for layout work without a debug build:
+ * Clang's "-Xclang -fdump-record-layouts" and GCC's "-fdump-lang-class".
+ * Neither is a stable format.  Clang prints offsets but not sizes; member
+ * sizes come from records dumped earlier in the same file and from the
+ * spelling of scalar types, and otherwise from the next member's offset.
+ * GCC's class dump has sizes and bases but no data members at all.  Both
+ * are assumed to be for an LP64 little-endian target.
+ */
+struct dumprec {
+	char		*type;		/* "struct foo", "Foo" */
+	Dwarf_Word	 size, nvsize;
+	unsigned	 align;
+};
+
+struct dumpent {
+	Dwarf_Word	 off;
+	unsigned	 level;
+	bool		 isbit;
+	unsigned	 bitlo, bithi;
+	char		*text;
+};
+
+static struct dumprec *dumprecs;
+static size_t ndumprecs, ndumpreccap;
+
+static struct dumprec *
+dumprec_find(const char *type)
+{
+	size_t i;
+
+	for (i = ndumprecs; i > 0; i--)
+		if (strcmp(dumprecs[i - 1].type, type) == 0)
+			return (&dumprecs[i - 1]);
+	return (NULL);
+}
+
+static struct dumprec *
+dumprec_add(const char *type, Dwarf_Word size, unsigned align)
+{
+	struct dumprec *rec;
+
+	if (ndumprecs == ndumpreccap) {
+		ndumpreccap = ndumpreccap ? ndumpreccap * 2 : 64;
+		dumprecs = xreallocarray(dumprecs, ndumpreccap,
+		    sizeof(*dumprecs));
+	}
+	rec = &dumprecs[ndumprecs++];
+	rec->type = xstrdup(type);
+	rec->size = rec->nvsize = size;
+	rec->align = align;
+	return (rec);
+}
+
+static void
+dumprecs_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < ndumprecs; i++)
+		free(dumprecs[i].type);
+	ndumprecs = 0;
+}
+
+static void
+rtrim(char *s)
+{
+	size_t n = strlen(s);
+
+	while (n > 0 && isspace((unsigned char)s[n - 1]))
+		s[--n] = '\0';
+}
+
+/* Strip 'word' from the front of 's', if present. */
+static bool
+strip_prefix(char **s, const char *word)
+{
+	size_t n = strlen(word);
+
+	if (strncmp(*s, word, n) != 0)
+		return (false);
+	*s += n;
+	return (true);
+}
+
+/* ... and from the end. */
+static bool
+strip_suffix(char *s, const char *word)
+{
+	size_t n = strlen(s), m = strlen(word);
+
+	if (n < m || strcmp(s + n - m, word) != 0)
+		return (false);
+	s[n - m] = '\0';
+	return (true);
+}
+
+/*
+ * Size and shape of a scalar, pointer or array type from its spelling in a
+ * Clang dump; 0 if unknown (typedefs other than the standard ones).
+ */
+static Dwarf_Word
+dump_type_size(const char *spelling, struct member *mem)
+{
+	static const struct {
+		const char	*name;
+		Dwarf_Word	 size;	/* 0: pointer-sized */
+	} scalars[] = {
+		{ "char", 1 }, { "signed char", 1 }, { "unsigned char", 1 },
+		{ "_Bool", 1 }, { "bool", 1 }, { "int8_t", 1 },
+		{ "uint8_t", 1 }, { "char8_t", 1 },
+		{ "short", 2 }, { "unsigned short", 2 }, { "int16_t", 2 },
+		{ "uint16_t", 2 }, { "char16_t", 2 },
+		{ "int", 4 }, { "unsigned int", 4 }, { "float", 4 },
+		{ "int32_t", 4 }, { "uint32_t", 4 }, { "char32_t", 4 },
+		{ "wchar_t", 4 },
+		{ "long", 0 }, { "unsigned long", 0 }, { "size_t", 0 },
+		{ "ssize_t", 0 }, { "intptr_t", 0 }, { "uintptr_t", 0 },
+		{ "ptrdiff_t", 0 },
+		{ "long long", 8 }, { "unsigned long long", 8 },
+		{ "double", 8 }, { "int64_t", 8 }, { "uint64_t", 8 },
+		{ "off_t", 8 },
+		{ "long double", 16 }, { "__int128", 16 },
+		{ "unsigned __int128", 16 },
+	};
+	Dwarf_Word count, n, size;
+	char buf[256], *p, *t, *end;
+	size_t i;
+
+	snprintf(buf, sizeof(buf), "%s", spelling);
+	t = buf;
+	if (strip_prefix(&t, "const "))
+		mem->flags |= MEM_CONST;
+	strip_prefix(&t, "volatile ");
+	strip_prefix(&t, "std::");
+
+	/* Arrays: "T[N][M]". */
+	if ((p = strchr(t, '[')) != NULL && strchr(t, '(') == NULL) {
+		count = 1;
+		for (end = p; *end == '['; end++) {
+			n = strtoull(end + 1, &end, 10);
+			if (*end != ']')
+				return (0);
+			count *= n;
+		}
+		*p = '\0';
+		rtrim(t);
+		size = dump_type_size(t, mem);
+		mem->flags |= MEM_ARRAY;
+		mem->nelems = count;
+		mem->elemsize = size;
+		return (size * count);
+	}
+
+	if (strip_suffix(t, " const"))
+		mem->flags |= MEM_CONST;
+	rtrim(t);
+	if (t[0] != '\0' && (t[strlen(t) - 1] == '*' ||
+	    t[strlen(t) - 1] == '&' || strstr(t, "(*") != NULL)) {
+		mem->flags |= MEM_POINTER;
+		mem->align = pointer_size;
+		return (pointer_size);
+	}
+	if (strncmp(t, "enum ", 5) == 0) {
+		mem->align = 4;
+		return (4);
+	}
+	for (i = 0; i < nitems(scalars); i++)
+		if (strcmp(t, scalars[i].name) == 0) {
+			size = scalars[i].size ? scalars[i].size :
+			    pointer_size;
+			mem->align = MIN(size, max_scalar_align);
+			return (size);
+		}
+	return (0);
+}
+
+static bool
+dump_wantstruct(const char *name)
+{
+	const char *bare;
+	size_t i;
+
+	if (allstructs)
+		return (name[0] != '<' && strncmp(name, "(anonymous", 10) != 0 &&
+		    strncmp(name, "(unnamed", 8) != 0);
+	bare = strrchr(name, ':');
+	if (bare != NULL && (bare == name || bare[-1] != ':'))
+		bare = NULL;
+	for (i = 0; i < structnames.n; i++) {
+		if (strcmp(name, structnames.v[i]) == 0 ||
+		    (bare != NULL && strcmp(bare + 1, structnames.v[i]) == 0))
+			return (true);
+	}
+	return (false);
+}
+
+static struct member *
+dump_member_add(struct layout *lay, unsigned *cap)
+{
+	struct member *mem;
+
+	if (lay->nmembers == *cap) {
+		*cap = *cap ? *cap * 2 : 16;
+		lay->members = xreallocarray(lay->members, *cap,
+		    sizeof(*lay->members));
+	}
+	mem = &lay->members[lay->nmembers++];
+	memset(mem, 0, sizeof(*mem));
+	return (mem);
+}
+
+/* Build a layout from one Clang "Dumping AST Record Layout" block. */
+static struct layout *
+clang_layout(struct dumpent *ents, size_t n, Dwarf_Word size, unsigned align)
+{
+	static const char *const basedesc[] = {
+		" (primary base)", " (base)", " (virtual base)",
+	};
+	struct layout *lay;
+	struct member *mem;
+	struct dumprec *rec;
+	Dwarf_Word bit, next;
+	unsigned cap, k;
+	size_t i, j;
+	bool empty, nested;
+	char *text, *sp, name[256];
+
+	lay = xcalloc(1, sizeof(*lay));
+	text = ents[0].text;
+	if (!strip_prefix(&text, "struct ") && !strip_prefix(&text, "class "))
+		strip_prefix(&text, "union ");
+	lay->name = xstrdup(text);
+	lay->size = size;
+	lay->align = align;
+	cap = 0;
+
+	for (i = 1; i < n; i++) {
+		if (ents[i].level != 1)
+			continue;
+		text = ents[i].text;
+		nested = i + 1 < n && ents[i + 1].level > 1;
+		empty = strip_suffix(text, " (empty)");
+
+		/* Zero-width bitfields take no space. */
+		if (ents[i].isbit && ents[i].bithi < ents[i].bitlo)
+			continue;
+
+		mem = dump_member_add(lay, &cap);
+		mem->offset = ents[i].off;
+		for (k = 0; k < nitems(basedesc); k++)
+			if (strip_suffix(text, basedesc[k]))
+				break;
+
+		if (k < nitems(basedesc)) {
+			mem->name = xstrdup(basedesc[k] + 1);
+			mem->type_name = xstrdup(text);
+			mem->flags = MEM_STRUCT;
+			if ((rec = dumprec_find(text)) != NULL) {
+				mem->size = rec->nvsize;
+				mem->align = rec->align;
+			}
+		} else if (text[0] == '(') {
+			/* "(Foo vtable pointer)" */
+			mem->name = xstrdup("_vptr");
+			mem->type_name = xstrdup("void *");
+			mem->flags = MEM_POINTER;
+			mem->size = mem->align = pointer_size;
+		} else {
+			sp = strrchr(text, ' ');
+			if (text[strlen(text) - 1] == ')' || sp == NULL) {
+				/* Anonymous struct or union member. */
+				snprintf(name, sizeof(name), "<anonymous>");
+				if ((sp = strchr(text, '(')) != NULL)
+					strcpy(sp, "<anonymous>");
+			} else {
+				snprintf(name, sizeof(name), "%s", sp + 1);
+				*sp = '\0';
+				rtrim(text);
+			}
+			mem->name = xstrdup(name);
+			mem->type_name = xstrdup(text);
+			if (nested) {
+				mem->flags = strncmp(text, "union ", 6) == 0 ?
+				    MEM_STRUCT | MEM_UNION : MEM_STRUCT;
+				if ((rec = dumprec_find(text)) != NULL) {
+					mem->size = rec->size;
+					mem->align = rec->align;
+				}
+			} else
+				mem->size = dump_type_size(text, mem);
+		}
+		if (empty)
+			mem->size = 0;
+
+		/*
+		 * "off:lo-hi" counts bits from the byte holding the first one.
+		 * Bitfields are placed by their storage unit, as from DWARF;
+		 * of a type of unknown size, only the bytes spanned are known.
+		 */
+		if (ents[i].isbit) {
+			bit = ents[i].off * 8 + ents[i].bitlo;
+			mem->flags |= MEM_BITFIELD;
+			mem->bitsize = ents[i].bithi - ents[i].bitlo + 1;
+			if (mem->size == 0) {
+				mem->size = howmany(ents[i].bithi + 1, 8);
+				mem->align = 1;
+			} else {
+				mem->offset = bit / 8 / mem->size * mem->size;
+				if (bit + mem->bitsize > (mem->offset +
+				    mem->size) * 8)
+					mem->offset = bit / 8;
+			}
+			mem->bitoff = bit - mem->offset * 8;
+		}
+
+		/* Unknown size: assume it runs up to the next member. */
+		if (mem->size == 0 && !empty) {
+			next = size;
+			for (j = i + 1; j < n; j++)
+				if (ents[j].level == 1 &&
+				    ents[j].off > mem->offset) {
+					next = ents[j].off;
+					break;
+				}
+			mem->size = next > mem->offset ? next - mem->offset : 0;
+		}
+		if (mem->align == 0)
+			mem->align = 1;
+	}
+
+	sort_members(lay);
+	lay->hash = layout_hash(lay);
+	return (lay);
+}
+
+/*
+ * Parse "    24 |   int x" or "  48:0-2 |   int bf" into 'ent'.  Returns
+ * false for lines that are not record entries.
+ */
+static bool
+clang_parse_entry(char *line, struct dumpent *ent)
+{
+	char *p, *bar;
+	unsigned spaces;
+
+	memset(ent, 0, sizeof(*ent));
+	p = line;
+	while (*p == ' ')
+		p++;
+	if (!isdigit((unsigned char)*p))
+		return (false);
+	ent->off = strtoull(p, &p, 10);
+	if (*p == ':') {
+		ent->isbit = true;
+		if (isdigit((unsigned char)p[1])) {
+			ent->bitlo = strtoul(p + 1, &p, 10);
+			if (*p != '-')
+				return (false);
+			ent->bithi = strtoul(p + 1, &p, 10);
+		} else {
+			/* Zero width. */
+			ent->bitlo = 1;
+			ent->bithi = 0;
+		}
+	}
+	if ((bar = strstr(p, " | ")) == NULL)
+		return (false);
+	p = bar + 3;
+	for (spaces = 0; p[spaces] == ' '; spaces++)
+		;
+	ent->level = spaces / 2;
+	ent->text = p + spaces;
+	rtrim(ent->text);
+	return (ent->text[0] != '\0');
+}
+
+static unsigned long
+dump_field(const char *line, const char *key)
+{
+	const char *p;
+
+	if ((p = strstr(line, key)) == NULL)
+		return (0);
+	return (strtoul(p + strlen(key), NULL, 10));
+}
+
+/*
+ * GCC "Class" block: size and alignment, bases (from the "NAME (0x...) OFF"
+ * hierarchy lines) and the vtable pointer, but no data members.
+ */
+static struct layout *
+gcc_layout(char **lines, size_t n)
+{
+	struct layout *lay;
+	struct member *mem;
+	struct dumprec *rec;
+	Dwarf_Word off;
+	unsigned cap;
+	size_t i, j;
+	bool vptr, overlap;
+	char *p, *t;
+
+	lay = xcalloc(1, sizeof(*lay));
+	lay->name = xstrdup(lines[0] + strlen("Class "));
+	lay->nofields = true;
+	cap = 0;
+	vptr = false;
+	for (i = 1; i < n; i++) {
+		t = lines[i];
+		while (*t == ' ')
+			t++;
+		if (strncmp(t, "size=", 5) == 0) {
+			lay->size = dump_field(t, "size=");
+			lay->align = dump_field(t, "align=");
+			continue;
+		}
+		if ((p = strstr(t, " (0x")) == NULL)
+			continue;
+		*p = '\0';
+		if ((p = strchr(p + 1, ')')) == NULL)
+			continue;
+		off = strtoull(p + 1, &p, 10);
+		if (strcmp(t, lay->name) == 0) {
+			vptr = i + 1 < n && strstr(lines[i + 1], "vptr=");
+			continue;
+		}
+		if (strstr(p, "virtual") != NULL)
+			continue;
+
+		/* Bases of bases lie inside their derived base. */
+		rec = dumprec_find(t);
+		overlap = false;
+		for (j = 0; j < lay->nmembers; j++)
+			if (off >= lay->members[j].offset && off <
+			    lay->members[j].offset + MAX(lay->members[j].size,
+			    1))
+				overlap = true;
+		if (overlap)
+			continue;
+		mem = dump_member_add(lay, &cap);
+		mem->name = xstrdup("(base)");
+		mem->type_name = xstrdup(t);
+		mem->offset = off;
+		mem->flags = MEM_STRUCT;
+		mem->size = rec != NULL ? rec->nvsize : 0;
+		mem->align = rec != NULL ? rec->align : 1;
+	}
+	if (vptr && (lay->nmembers == 0 || lay->members[0].offset != 0)) {
+		mem = dump_member_add(lay, &cap);
+		mem->name = xstrdup("_vptr");
+		mem->type_name = xstrdup("void *");
+		mem->flags = MEM_POINTER;
+		mem->size = mem->align = pointer_size;
+	}
+
+	sort_members(lay);
+	lay->hash = layout_hash(lay);
+	return (lay);
+}
+
+static void
+dump_add(struct layout *lay, const char *path)
+{
+
+	if (!lookup_done && dump_wantstruct(lay->name)) {
+		variant_add(lay, path);
+		lookup_done = !findall;
+	} else
+		layout_free(lay);
+}
+
+static struct dumprec *
+gcc_flush(char **lines, size_t n, const char *path)
+{
+	struct dumprec *rec;
+	struct layout *lay;
+	size_t i;
+
+	lay = gcc_layout(lines, n);
+	rec = dumprec_add(lay->name, lay->size, lay->align);
+	for (i = 0; i < n; i++) {
+		if (strstr(lines[i], "base size=") != NULL)
+			rec->nvsize = dump_field(lines[i], "base size=");
+		free(lines[i]);
+	}
+	dump_add(lay, path);
+	return (rec);
+}
+
+static void
+scan_dump(const char *path)
+{
+	struct dumpent *ents;
+	struct dumprec *rec;
+	struct layout *lay;
+	FILE *f;
+	char **lines, *line;
+	size_t i, linecap, nents, entcap, nlines, linescap;
+	ssize_t len;
+	enum { NONE, CLANG, GCC } state;
+
+	if ((f = fopen(path, "r")) == NULL)
+		err(EX_NOINPUT, "%s", path);
+
+	pointer_size = 8;
+	max_scalar_align = 16;
+	bigendian = false;
+	lookup_done = false;
+
+	ents = NULL;
+	lines = NULL;
+	nents = entcap = nlines = linescap = 0;
+	line = NULL;
+	linecap = 0;
+	rec = NULL;
+	state = NONE;
+	while ((len = getline(&line, &linecap, f)) != -1) {
+		rtrim(line);
+
+		/* GCC blocks end at a blank line. */
+		if (state == GCC && line[0] == '\0') {
+			rec = gcc_flush(lines, nlines, path);
+			nlines = 0;
+			state = NONE;
+			continue;
+		}
+		if (state == NONE && strncmp(line, "Class ", 6) == 0)
+			state = GCC;
+		if (state == GCC) {
+			if (nlines == linescap) {
+				linescap = linescap ? linescap * 2 : 32;
+				lines = xreallocarray(lines, linescap,
+				    sizeof(*lines));
+			}
+			lines[nlines++] = xstrdup(line);
+			continue;
+		}
+
+		if (strstr(line, "*** Dumping AST Record Layout") != NULL) {
+			for (i = 0; i < nents; i++)
+				free(ents[i].text);
+			nents = 0;
+			state = CLANG;
+			continue;
+		}
+		/* C++ records print nvsize on the line after sizeof. */
+		if (state == NONE && rec != NULL &&
+		    strstr(line, "nvsize=") != NULL) {
+			rec->nvsize = dump_field(line, "nvsize=");
+			continue;
+		}
+		if (state != CLANG)
+			continue;
+
+		if (strstr(line, "[sizeof=") != NULL) {
+			state = NONE;
+			if (nents == 0)
+				continue;
+			lay = clang_layout(ents, nents,
+			    dump_field(line, "[sizeof="),
+			    dump_field(line, " align="));
+			rec = dumprec_add(ents[0].text, lay->size,
+			    lay->align);
+			if (strstr(line, "nvsize=") != NULL)
+				rec->nvsize = dump_field(line, "nvsize=");
+			dump_add(lay, path);
+			continue;
+		}
+		if (nents == entcap) {
+			entcap = entcap ? entcap * 2 : 64;
+			ents = xreallocarray(ents, entcap, sizeof(*ents));
+		}
+		if (clang_parse_entry(line, &ents[nents])) {
+			ents[nents].text = xstrdup(ents[nents].text);
+			nents++;
+		}
+	}
+	if (ferror(f))
+		err(EX_IOERR, "%s", path);
+	if (state == GCC)
+		gcc_flush(lines, nlines, path);
+
+	for (i = 0; i < nents; i++)
+		free(ents[i].text);
+	free(ents);
+	free(lines);
+	free(line);
+	fclose(f);
+	dumprecs_reset();
+}
+
+/*
+ * Header quick mode (-H): compile a stub translation unit that includes the
+ * header and uses the struct, then analyze the object.  Objects are cached
+ * by the header's contents, the compiler, the -I flags and the struct name;
+ * headers it includes in turn are not part of the key.
+ */
+static const char *
+cache_dir(void)
+{
+	static char dir[PATH_MAX];
+	const char *base;
+	char *p;
+	bool last;
+
+	if ((base = getenv("STRUCTHOLE_CACHE")) != NULL)
+		snprintf(dir, sizeof(dir), "%s", base);
+	else if ((base = getenv("XDG_CACHE_HOME")) != NULL)
+		snprintf(dir, sizeof(dir), "%s/structhole", base);
+	else if ((base = getenv("HOME")) != NULL)
+		snprintf(dir, sizeof(dir), "%s/.cache/structhole", base);
+	else
+		snprintf(dir, sizeof(dir), "/tmp/structhole-%ju",
+		    (uintmax_t)getuid());
+
+	/* mkdir -p */
+	for (p = dir + 1; ; p++) {
+		if (*p != '/' && *p != '\0')
+			continue;
+		last = *p == '\0';
+		*p = '\0';
+		if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+			err(EX_CANTCREAT, "%s", dir);
+		if (last)
+			break;
+		*p = '/';
+	}
+	return (dir);
+}
+
+static uint64_t
+header_key(const char *path, const char *cc, bool cplusplus)
+{
+	char buf[65536];
+	uint64_t h;
+	ssize_t n;
+	size_t i;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		err(EX_NOINPUT, "%s", path);
+	h = 0xcbf29ce484222325ull;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		h = fnv1a(h, buf, n);
+	if (n == -1)
+		err(EX_IOERR, "%s", path);
+	close(fd);
+
+	h = fnv1a(h, cc, strlen(cc) + 1);
+	for (i = 0; i < incdirs.n; i++)
+		h = fnv1a(h, incdirs.v[i], strlen(incdirs.v[i]) + 1);
+	if (!allstructs)
+		h = fnv1a(h, structname, strlen(structname) + 1);
+	h = fnv1a(h, &cplusplus, sizeof(cplusplus));
+	return (h);
+}
+
+static bool
+run_compiler(const char **args)
+{
+	pid_t pid;
+	int error, status;
+
+	error = posix_spawnp(&pid, args[0], NULL, NULL, __DECONST(char **, args),
+	    environ);
+	if (error != 0) {
+		errno = error;
+		err(EX_UNAVAILABLE, "%s", args[0]);
+	}
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR)
+			err(EX_OSERR, "waitpid");
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* Path of the (possibly cached) stub object for 'header'. */
+static char *
+header_object(const char *path)
+{
+	static char obj[PATH_MAX];
+	char stub[PATH_MAX], tmp[PATH_MAX], abshdr[PATH_MAX];
+	const char **args;
+	char *ccbuf, *tok, *p;
+	const char *cc, *dir, *ext;
+	struct stat sb;
+	size_t nargs, i;
+	bool cplusplus;
+	FILE *f;
+
+	if (realpath(path, abshdr) == NULL)
+		err(EX_NOINPUT, "%s", path);
+	if ((cc = getenv("STRUCTHOLE_CC")) == NULL &&
+	    (cc = getenv("CC")) == NULL)
+		cc = "cc";
+	ext = strrchr(abshdr, '.');
+	cplusplus = ext != NULL && (strcmp(ext, ".hpp") == 0 ||
+	    strcmp(ext, ".hh") == 0 || strcmp(ext, ".hxx") == 0 ||
+	    strcmp(ext, ".H") == 0);
+
+	dir = cache_dir();
+	if (snprintf(obj, sizeof(obj), "%s/%016jx.o", dir,
+	    (uintmax_t)header_key(abshdr, cc, cplusplus)) >= (int)sizeof(obj) ||
+	    snprintf(stub, sizeof(stub), "%s/stub-%ju.%s", dir,
+	    (uintmax_t)getpid(), cplusplus ? "cc" : "c") >= (int)sizeof(stub) ||
+	    snprintf(tmp, sizeof(tmp), "%s.%ju", obj, (uintmax_t)getpid()) >=
+	    (int)sizeof(tmp))
+		errx(EX_CANTCREAT, "%s: cache path too long", dir);
+	if (stat(obj, &sb) == 0)
+		return (obj);
+
+	/* The header goes in with -include; its path needs no quoting. */
+	if ((f = fopen(stub, "w")) == NULL)
+		err(EX_CANTCREAT, "%s", stub);
+	fprintf(f, "/* structhole stub */\n");
+	if (!allstructs)
+		fprintf(f, "struct %s *structhole_stub;\n"
+		    "char structhole_stub_size[sizeof(struct %s)];\n",
+		    structname, structname);
+	if (fclose(f) != 0)
+		err(EX_IOERR, "%s", stub);
+
+	/* The compiler may be a command line, e.g. "ccache gcc -m32". */
+	ccbuf = xstrdup(cc);
+	args = xcalloc(strlen(cc) + incdirs.n * 2 + 10, sizeof(*args));
+	nargs = 0;
+	for (p = ccbuf; (tok = nexttok(&p)) != NULL; )
+		args[nargs++] = tok;
+	if (nargs == 0)
+		errx(EX_USAGE, "empty compiler command");
+	for (i = 0; i < incdirs.n; i++) {
+		args[nargs++] = "-I";
+		args[nargs++] = incdirs.v[i];
+	}
+	args[nargs++] = "-include";
+	args[nargs++] = abshdr;
+	args[nargs++] = "-g";
+	args[nargs++] = "-fno-eliminate-unused-debug-types";
+	args[nargs++] = "-c";
+	args[nargs++] = "-o";
+	args[nargs++] = tmp;
+	args[nargs++] = stub;
+	args[nargs] = NULL;
+	if (!run_compiler(args)) {
+		unlink(stub);
+		unlink(tmp);
+		errx(EX_DATAERR, "%s failed on the stub for %s", args[0],
+		    path);
+	}
+	unlink(stub);
+	free(args);
+	free(ccbuf);
+
+	if (rename(tmp, obj) == -1)
+		err(EX_CANTCREAT, "%s", obj);
+	return (obj);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timing tm;
+	char *hdrobj, *name, *p, insrep[8];
+	int ch, i;
+
+	argv0 = argv[0];
+	while ((ch = getopt(argc, argv, "A:aB:CE:FG:H:I:i:Lj:l:n:O:P:p:qr:tu:")) != -1) {
+		switch (ch) {
+		case 'A':
+			annot_load(optarg);
+			break;
+		case 'a':
+			allstructs = true;
+			break;
+		case 'B':
+			bigbuffer = getnum(optarg, "buffer size", 1, 1ul << 30);
+			break;
+		case 'C':
+			cuvariants = true;
+			break;
+		case 'E':
+			if (strncmp(optarg, "btf", 3) == 0 &&
+			    (optarg[3] == '\0' || optarg[3] == '=')) {
+				btfout = true;
+				if (optarg[3] == '=' && optarg[4] != '\0')
+					btffile = optarg + 4;
+				break;
+			}
+			if (strcmp(optarg, "schema") != 0 &&
+			    strcmp(optarg, "c") != 0)
+				errx(EX_USAGE, "unknown export format: %s",
+				    optarg);
+			exportfmt = optarg;
+			break;
+		case 'F':
+			fleet = true;
+			break;
+		case 'G':
+			cachegeom_add(optarg);
+			break;
+		case 'H':
+			header = optarg;
+			break;
+		case 'I':
+			strlist_add(&incdirs, optarg);
+			break;
+		case 'i':
+			strlist_add(&inserts, optarg);
+			break;
+		case 'L':
+			dumps = true;
+			break;
+		case 'j':
+			nthreads = getnum(optarg, "thread count", 1, 256);
+			break;
+		case 'l':
+			culangs_enable(optarg);
+			break;
+		case 'n':
+			nearmiss = getnum(optarg, "near-miss distance", 1,
+			    4096);
+			break;
+		case 'O':
+			orderfile = optarg;
+			break;
+		case 'P':
+			npayloads = 0;
+			while ((name = strsep(&optarg, ",")) != NULL) {
+				if (npayloads == nitems(payloads))
+					errx(EX_USAGE, "at most %zu payload "
+					    "lengths", nitems(payloads));
+				payloads[npayloads++] = getnum(name,
+				    "payload length", 0, 1ul << 30);
+			}
+			break;
+		case 'p':
+			strlist_add(&cuprods, optarg);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'r':
+			reports_enable(optarg);
+			break;
+		case 't':
+			timing = true;
+			break;
+		case 'u':
+			strlist_add(&cunames, optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if ((exportfmt != NULL || btfout) && fleet)
+		errx(EX_USAGE, "-E and -F are mutually exclusive");
+	if (btfout && dumps)
+		errx(EX_USAGE, "-E btf needs DWARF, not -L dumps");
+	if (btfout && cuvariants)
+		errx(EX_USAGE, "-E btf and -C are mutually exclusive");
+	/* Types are encoded as their structs are found, on this thread. */
+	if (btfout)
+		nthreads = 1;
+	if (header != NULL && dumps)
+		errx(EX_USAGE, "-H and -L are mutually exclusive");
+	if (orderfile != NULL) {
+		snprintf(insrep, sizeof(insrep), "order");
+		reports_enable(insrep);
+	}
+	if (inserts.n > 0) {
+		snprintf(insrep, sizeof(insrep), "insert");
+		reports_enable(insrep);
+	} else if (report_enabled(report_insert))
+		errx(EX_USAGE, "the insert report needs -i");
+	if (!allstructs) {
+		if (argc < 1)
+			usage();
+		for (p = argv[0]; (name = strsep(&p, ",")) != NULL;)
+			if (*name != '\0')
+				strlist_add(&structnames, name);
+		if (structnames.n == 0)
+			usage();
+		structname = structnames.v[0];
+		argc--;
+		argv++;
+	}
+	findall = allstructs || cuvariants || structnames.n > 1;
+	if (header != NULL) {
+		if (structnames.n > 1)
+			errx(EX_USAGE, "-H takes a single struct name");
+		if (argc != 0)
+			usage();
+		hdrobj = header_object(header);
+		argv = &hdrobj;
+		argc = 1;
+	}
+	if (argc < 1)
+		usage();
+	if (btffile != NULL && argc > 1)
+		errx(EX_USAGE, "-E btf=%s takes a single binary", btffile);
+
+	elf_version(EV_CURRENT);
+
+	for (i = 0; i < argc; i++) {
+		if (timing)
+			timing_begin(&tm);
+		if (dumps)
+			scan_dump(argv[i]);
+		else
+			scan_binary(argv[i]);
+		if (timing)
+			timing_end(argv[i], &tm);
+
+		if (argc > 1 && (!fleet || wantvars))
+			printf("%s/* %s */\n", i > 0 ? "\n" : "", argv[i]);
+		if (!fleet) {
+			if (btfout)
+				btf_write(argv[i]);
+			else if (cuvariants)
+				fleet_report("CU", "CUs");
+			else
+				print_variants();
+			variants_reset();
+		}
+		run_binreports();
+		globals_reset();
+	}
+	if (fleet)
+		fleet_report(cuvariants ? "CU" : "binary",
+		    cuvariants ? "CUs" : "binaries");
 
-	return (EX_OK);
+	return (export_failed ? EX_DATAERR : EX_OK);
 }